@@ -0,0 +1,109 @@
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/asio.hpp>
+
+#include "common.h"
+
+namespace p_opt = boost::program_options;
+
+using boost::asio::ip::tcp;
+
+// program parameters
+uint32_t connections_to_open;
+uint16_t threads_count;
+
+/* = = = = = = = = = = = = = = = = = = *
+ * BENCHMARK OF ACCEPTING CONNECTIONS  *
+ * = = = = = = = = = = = = = = = = = = */
+
+/* Wątki klienckie naraz otwierają połączenia z serwerem (tak jak gracze na początku turnieju).
+ * Połączenie liczy się jako przyjęte, gdy przyszedł pierwszy bajt komunikatu Hello,
+ * czyli serwer je zaakceptował i zarejestrował. Potem połączenie jest zamykane, więc
+ * limit max-connections serwera nie jest osiągany. */
+
+std::atomic<uint32_t> connections_left;
+std::atomic<uint32_t> connections_accepted = 0;
+std::atomic<uint32_t> connections_failed = 0;
+
+void open_connections(const tcp::resolver::results_type &server_endpoints) {
+    boost::asio::io_context io_context;
+    while (true) {
+        auto left = connections_left.load();
+        do {
+            if (left == 0)
+                return;
+        } while (!connections_left.compare_exchange_weak(left, left - 1));
+
+        boost::system::error_code error;
+        tcp::socket socket(io_context);
+        boost::asio::connect(socket, server_endpoints, error);
+        char first_byte;
+        if (!error)
+            boost::asio::read(socket, boost::asio::buffer(&first_byte, 1), error);
+        if (error || first_byte != (char) ServerMessageType::Hello)
+            connections_failed++;
+        else
+            connections_accepted++;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string server_address;
+    try {
+        p_opt::options_description description("Allowed options");
+        description.add_options()
+                ("help,h", "Wypisuje jak używać programu")
+                ("server-address,s", p_opt::value<std::string>(&server_address)->required(),
+                 "<(nazwa hosta):(port) lub (IPv4):(port) lub (IPv6):(port)> serwera")
+                ("connections,c", p_opt::value<uint32_t>(&connections_to_open)->default_value(10000),
+                 "(opcjonalny) liczba połączeń do otwarcia")
+                ("threads,t", p_opt::value<uint16_t>(&threads_count)->default_value(4),
+                 "(opcjonalny) liczba wątków otwierających połączenia");
+
+        p_opt::variables_map var_map;
+        p_opt::store(p_opt::parse_command_line(argc, argv, description), var_map);
+
+        if (var_map.count("help")) {
+            std::cout << description << "\n";
+            return 0;
+        }
+
+        p_opt::notify(var_map);
+    }
+    catch (std::exception &e) {
+        std::cout << e.what() << '\n';
+        return 1;
+    }
+
+    auto split_server_address = split_address(server_address);
+    boost::asio::io_context io_context;
+    tcp::resolver resolver(io_context);
+    tcp::resolver::results_type server_endpoints;
+    try {
+        server_endpoints = resolver.resolve(split_server_address.first, split_server_address.second);
+    } catch (std::exception &e) {
+        std::cerr << "Error: resolving server address failed" << std::endl;
+        return 1;
+    }
+
+    connections_left = connections_to_open;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint16_t i = 0; i < std::max(threads_count, (uint16_t) 1); i++) {
+        threads.emplace_back(open_connections, std::cref(server_endpoints));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "accepted: " << connections_accepted << ", failed: " << connections_failed
+              << ", time: " << elapsed.count() << " s, "
+              << (uint64_t) (connections_accepted / elapsed.count()) << " connections/s" << std::endl;
+    return 0;
+}
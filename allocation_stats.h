@@ -0,0 +1,158 @@
+#ifndef SIK_2022_ALLOCATION_STATS_H
+#define SIK_2022_ALLOCATION_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <new>
+
+#define ALLOCATION_PHASES 5
+#define ALLOCATION_STATS_MAX_THREADS 256 // threads after that share the last counters
+
+/* = = = = = = = = = = = = = = = = = = *
+ * ALLOCATION ACCOUNTING BUILD MODE    *
+ * = = = = = = = = = = = = = = = = = = */
+
+/* Po zbudowaniu z -DALLOCATION_STATS (make ALLOCATION_STATS=1) globalne operator new/delete
+ * są zastąpione wersjami, które liczą alokacje i bajty osobno dla każdego wątku i przypisują je
+ * do bieżącej fazy wątku (ustawianej przez allocation_phase_scope). Liczniki wątku zapisuje tylko
+ * ten wątek, a raport co turę sumuje liczniki wszystkich wątków i wypisuje przyrost od poprzedniego
+ * raportu na stderr. Fazy liczone przez inne wątki niż raportujący (np. kodowanie tury w wątku
+ * rozsyłającym) trafiają do raportu, który nastąpi po nich.
+ * Bez ALLOCATION_STATS wszystko poniżej nic nie robi. Operatory są definiowane w tym nagłówku,
+ * więc może go dołączać tylko jedna jednostka kompilacji programu (każdy program to jeden plik .cpp). */
+
+enum class AllocationPhase {
+    Other,
+    TurnCompute,
+    Encode,
+    Parse,
+    DrawBuild
+};
+
+#ifdef ALLOCATION_STATS
+
+struct allocation_counters {
+    std::array<std::atomic<uint64_t>, ALLOCATION_PHASES> count{};
+    std::array<std::atomic<uint64_t>, ALLOCATION_PHASES> bytes{};
+};
+
+// Plain arrays and trivially initialized thread_locals, so counting never allocates by itself
+inline std::array<allocation_counters, ALLOCATION_STATS_MAX_THREADS> thread_allocation_counters;
+inline std::atomic<size_t> used_allocation_counters = 0;
+inline thread_local allocation_counters *own_allocation_counters = nullptr;
+inline thread_local AllocationPhase current_allocation_phase = AllocationPhase::Other;
+
+inline void count_allocation(size_t size) {
+    if (own_allocation_counters == nullptr) {
+        auto index = std::min(used_allocation_counters.fetch_add(1), (size_t) ALLOCATION_STATS_MAX_THREADS - 1);
+        own_allocation_counters = &thread_allocation_counters[index];
+    }
+    auto phase = (size_t) current_allocation_phase;
+    own_allocation_counters->count[phase].fetch_add(1, std::memory_order_relaxed);
+    own_allocation_counters->bytes[phase].fetch_add(size, std::memory_order_relaxed);
+}
+
+// libstdc++ implements array, nothrow and sized variants with these ones, so they are counted too
+void *operator new(size_t size) {
+    count_allocation(size);
+    if (auto pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    count_allocation(size);
+    auto align = (size_t) alignment;
+    // aligned_alloc needs a size that is a nonzero multiple of the alignment
+    if (auto pointer = std::aligned_alloc(align, std::max((size + align - 1) / align * align, align)))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+// Not inlined, otherwise gcc sees free() called on memory from operator new and warns (-Wmismatched-new-delete)
+[[gnu::noinline]] void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void *pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void *pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+// Allocations of the calling thread are attributed to phase until the scope ends
+class allocation_phase_scope {
+public:
+    explicit allocation_phase_scope(AllocationPhase phase) : previous_(current_allocation_phase) {
+        current_allocation_phase = phase;
+    }
+
+    ~allocation_phase_scope() {
+        current_allocation_phase = previous_;
+    }
+
+    allocation_phase_scope(const allocation_phase_scope &) = delete;
+    allocation_phase_scope &operator=(const allocation_phase_scope &) = delete;
+
+private:
+    AllocationPhase previous_;
+};
+
+// Prints allocations of all threads since the previous report, can be called from any thread
+class allocation_report {
+public:
+    void print(uint32_t turn) {
+        static constexpr std::array<const char *, ALLOCATION_PHASES> names{
+                "other", "turn compute", "encode", "parse", "draw build"};
+        const std::lock_guard<std::mutex> lock(mutex_);
+        std::array<uint64_t, ALLOCATION_PHASES> count{};
+        std::array<uint64_t, ALLOCATION_PHASES> bytes{};
+        auto threads = std::min(used_allocation_counters.load(), (size_t) ALLOCATION_STATS_MAX_THREADS);
+        for (size_t thread = 0; thread < threads; thread++) {
+            for (size_t phase = 0; phase < ALLOCATION_PHASES; phase++) {
+                count[phase] += thread_allocation_counters[thread].count[phase].load(std::memory_order_relaxed);
+                bytes[phase] += thread_allocation_counters[thread].bytes[phase].load(std::memory_order_relaxed);
+            }
+        }
+        std::cerr << "turn " << turn << ": allocations";
+        for (size_t phase = 0; phase < ALLOCATION_PHASES; phase++) {
+            std::cerr << (phase == 0 ? " " : ", ") << names[phase] << " " << count[phase] - last_count_[phase]
+                      << " (" << bytes[phase] - last_bytes_[phase] << " B)";
+        }
+        std::cerr << std::endl;
+        last_count_ = count;
+        last_bytes_ = bytes;
+    }
+
+private:
+    std::mutex mutex_;
+    std::array<uint64_t, ALLOCATION_PHASES> last_count_{};
+    std::array<uint64_t, ALLOCATION_PHASES> last_bytes_{};
+};
+
+#else // allocations aren't counted
+
+class allocation_phase_scope {
+public:
+    explicit allocation_phase_scope(AllocationPhase) {}
+};
+
+class allocation_report {
+public:
+    void print(uint32_t) {}
+};
+
+#endif // ALLOCATION_STATS
+
+#endif //SIK_2022_ALLOCATION_STATS_H
@@ -0,0 +1,267 @@
+#ifndef SIK_2022_BOT_H
+#define SIK_2022_BOT_H
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "tile_map.h"
+
+#define BOT_SEARCH_DEPTH 24 // BFS looks at most this many moves away
+
+/* = = = = = = = = = = = = = = = = = = *
+ * BOT PLAYING INSTEAD OF THE PLAYER   *
+ * = = = = = = = = = = = = = = = = = = */
+
+/* Bot trzyma mapę zagrożenia: dla każdego pola liczbę bomb, których wybuch je obejmie.
+ * Mapa jest aktualizowana przyrostowo - przy położeniu i wybuchu bomby dodawany lub odejmowany
+ * jest tylko zasięg tej bomby, a przy zmianie bloku przeliczane są tylko bomby, których zasięg
+ * przechodzi przez to pole. Ruch jest wybierany przeszukiwaniem BFS w oknie wokół robota,
+ * więc czas decyzji nie zależy od rozmiaru planszy. */
+class bot_player {
+public:
+    bot_player(uint16_t size_x, uint16_t size_y, uint16_t explosion_radius, uint16_t bomb_timer)
+            : size_x_(size_x), size_y_(size_y), explosion_radius_(explosion_radius), bomb_timer_(bomb_timer),
+              distances_(WINDOW_SIZE * WINDOW_SIZE), first_moves_(WINDOW_SIZE * WINDOW_SIZE) {}
+
+    void bomb_placed(BombId id, Position position, const tile_map &blocks) {
+        bomb_exploded(id); // bomb with the same id is replaced
+        auto &bomb = bombs_[id];
+        bomb.position = position;
+        bomb.cells = explosion_cells(position, blocks);
+        add_danger(bomb.cells, 1);
+    }
+
+    void bomb_exploded(BombId id) {
+        auto found = bombs_.find(id);
+        if (found == bombs_.end())
+            return;
+        add_danger(found->second.cells, -1);
+        bombs_.erase(found);
+    }
+
+    // Block was placed or destroyed, explosions of bombs in the same row or column may change
+    void block_changed(Position block, const tile_map &blocks) {
+        for (auto &bomb : bombs_) {
+            auto center = bomb.second.position;
+            if ((center.first == block.first && distance(center.second, block.second) <= explosion_radius_)
+                || (center.second == block.second && distance(center.first, block.first) <= explosion_radius_)) {
+                add_danger(bomb.second.cells, -1);
+                bomb.second.cells = explosion_cells(center, blocks);
+                add_danger(bomb.second.cells, 1);
+            }
+        }
+    }
+
+    // Events of one turn, given after all of them were applied to blocks
+    void turn_events(const std::pmr::vector<Event> &events, const tile_map &blocks) {
+        std::vector<Position> changed_blocks;
+        for (auto &event : events) { // ids of exploded bombs can be used again in the same turn
+            if (event.type == EventType::BombExploded) {
+                auto &event_desc = std::get<event_bomb_exploded_t>(event.variant);
+                bomb_exploded(event_desc.id);
+                changed_blocks.insert(changed_blocks.end(), event_desc.blocks_destroyed.begin(),
+                                      event_desc.blocks_destroyed.end());
+            }
+        }
+        for (auto &event : events) {
+            if (event.type == EventType::BombPlaced) {
+                auto &event_desc = std::get<event_bomb_placed_t>(event.variant);
+                bomb_placed(event_desc.id, event_desc.position, blocks);
+            } else if (event.type == EventType::BlockPlaced) {
+                changed_blocks.push_back(std::get<event_block_placed_t>(event.variant).position);
+            }
+        }
+        for (auto &block : changed_blocks) {
+            block_changed(block, blocks);
+        }
+    }
+
+    bool is_dangerous(Position position) const {
+        return danger_.contains(position);
+    }
+
+    // Action for the next turn, nothing if the robot should stay
+    std::optional<ClientMessage> choose_action(Position robot, const std::vector<Position> &enemies,
+                                               const tile_map &blocks) {
+        if (is_dangerous(robot)) { // run to the nearest safe position
+            search(robot, blocks, true);
+            auto move = move_towards([this](Position position) { return !is_dangerous(position); });
+            if (move)
+                return ClientMessage({ClientMessageType::Move, move.value()});
+            return std::nullopt;
+        }
+
+        if (worth_bombing(robot, enemies, blocks) && can_escape_own_bomb(robot, blocks))
+            return ClientMessage({ClientMessageType::PlaceBomb, std::monostate()});
+
+        // go next to the nearest block or enemy, never entering dangerous positions
+        search(robot, blocks, false);
+        auto move = move_towards([&](Position position) {
+            return position != robot && (next_to_block(position, blocks) || in_line_with_enemy(position, enemies));
+        });
+        if (move)
+            return ClientMessage({ClientMessageType::Move, move.value()});
+        // nothing to do nearby, build a cover
+        if (!blocks.contains(robot))
+            return ClientMessage({ClientMessageType::PlaceBlock, std::monostate()});
+        return std::nullopt;
+    }
+
+private:
+    static constexpr int WINDOW_SIZE = 2 * BOT_SEARCH_DEPTH + 1;
+    static constexpr std::array<std::pair<int, int>, 4> MOVES{{{0, 1}, {1, 0}, {0, -1}, {-1, 0}}}; // by Direction
+
+    struct bomb_t {
+        Position position;
+        std::vector<Position> cells;
+    };
+
+    struct position_hash {
+        size_t operator()(Position position) const {
+            return ((size_t) position.first << 16) | position.second;
+        }
+    };
+
+    static uint16_t distance(uint16_t a, uint16_t b) {
+        return a > b ? (uint16_t) (a - b) : (uint16_t) (b - a);
+    }
+
+    // The same explosion as drawn by the client: stops on the first block and on the border of the board
+    std::vector<Position> explosion_cells(Position center, const tile_map &blocks) const {
+        std::vector<Position> cells = {center};
+        if (blocks.contains(center))
+            return cells;
+        for (auto &move : MOVES) {
+            for (int i = 1; i <= explosion_radius_; i++) {
+                int x = center.first + move.first * i;
+                int y = center.second + move.second * i;
+                if (!inside(x, y))
+                    break;
+                cells.push_back({(uint16_t) x, (uint16_t) y});
+                if (blocks.contains(cells.back()))
+                    break;
+            }
+        }
+        return cells;
+    }
+
+    void add_danger(const std::vector<Position> &cells, int change) {
+        for (auto &cell : cells) {
+            auto &count = danger_[cell];
+            count = (uint16_t) (count + change);
+            if (count == 0)
+                danger_.erase(cell);
+        }
+    }
+
+    bool inside(int x, int y) const {
+        return x >= 0 && x < size_x_ && y >= 0 && y < size_y_;
+    }
+
+    bool next_to_block(Position position, const tile_map &blocks) const {
+        for (auto &move : MOVES) {
+            int x = position.first + move.first;
+            int y = position.second + move.second;
+            if (inside(x, y) && blocks.contains({(uint16_t) x, (uint16_t) y}))
+                return true;
+        }
+        return false;
+    }
+
+    bool in_line_with_enemy(Position position, const std::vector<Position> &enemies) const {
+        for (auto &enemy : enemies) {
+            if ((enemy.first == position.first && distance(enemy.second, position.second) <= explosion_radius_)
+                || (enemy.second == position.second && distance(enemy.first, position.first) <= explosion_radius_))
+                return true;
+        }
+        return false;
+    }
+
+    bool worth_bombing(Position robot, const std::vector<Position> &enemies, const tile_map &blocks) const {
+        return !blocks.contains(robot) && (next_to_block(robot, blocks) || in_line_with_enemy(robot, enemies));
+    }
+
+    // After placing a bomb the robot has bomb_timer - 1 moves before it explodes
+    bool can_escape_own_bomb(Position robot, const tile_map &blocks) {
+        if (bomb_timer_ <= 1)
+            return false;
+        auto own_explosion = explosion_cells(robot, blocks);
+        search(robot, blocks, false); // own bomb doesn't stop moves, only escape targets are checked
+        for (int i = 0; i < WINDOW_SIZE * WINDOW_SIZE; i++) {
+            if (distances_[i] < 0 || distances_[i] >= bomb_timer_)
+                continue;
+            auto position = window_position(robot, i);
+            if (std::find(own_explosion.begin(), own_explosion.end(), position) == own_explosion.end())
+                return true;
+        }
+        return false;
+    }
+
+    // BFS from the robot in the window around it, dangerous positions are entered only if through_danger is set
+    void search(Position robot, const tile_map &blocks, bool through_danger) {
+        search_origin_ = robot;
+        std::fill(distances_.begin(), distances_.end(), -1);
+        std::vector<int> queue = {window_index(0, 0)};
+        distances_[queue[0]] = 0;
+        for (size_t next = 0; next < queue.size(); next++) {
+            auto index = queue[next];
+            int dx = index / WINDOW_SIZE - BOT_SEARCH_DEPTH;
+            int dy = index % WINDOW_SIZE - BOT_SEARCH_DEPTH;
+            for (size_t direction = 0; direction < MOVES.size(); direction++) {
+                int ndx = dx + MOVES[direction].first;
+                int ndy = dy + MOVES[direction].second;
+                int x = robot.first + ndx;
+                int y = robot.second + ndy;
+                if (std::abs(ndx) > BOT_SEARCH_DEPTH || std::abs(ndy) > BOT_SEARCH_DEPTH || !inside(x, y))
+                    continue;
+                auto neighbour_index = window_index(ndx, ndy);
+                Position neighbour = {(uint16_t) x, (uint16_t) y};
+                if (distances_[neighbour_index] >= 0 || blocks.contains(neighbour))
+                    continue;
+                if (!through_danger && is_dangerous(neighbour))
+                    continue;
+                distances_[neighbour_index] = (int16_t) (distances_[index] + 1);
+                first_moves_[neighbour_index] = index == queue[0] ? (Direction) direction : first_moves_[index];
+                queue.push_back(neighbour_index);
+            }
+        }
+    }
+
+    // First move of the shortest path from the last search to a position satisfying target
+    template<typename Target>
+    std::optional<Direction> move_towards(Target target) const {
+        int best = -1;
+        for (int i = 0; i < WINDOW_SIZE * WINDOW_SIZE; i++) {
+            if (distances_[i] <= 0 || (best >= 0 && distances_[i] >= distances_[best]))
+                continue;
+            if (target(window_position(search_origin_, i)))
+                best = i;
+        }
+        if (best < 0)
+            return std::nullopt;
+        return first_moves_[best];
+    }
+
+    static int window_index(int dx, int dy) {
+        return (dx + BOT_SEARCH_DEPTH) * WINDOW_SIZE + (dy + BOT_SEARCH_DEPTH);
+    }
+
+    static Position window_position(Position origin, int index) {
+        return {(uint16_t) (origin.first + index / WINDOW_SIZE - BOT_SEARCH_DEPTH),
+                (uint16_t) (origin.second + index % WINDOW_SIZE - BOT_SEARCH_DEPTH)};
+    }
+
+    uint16_t size_x_;
+    uint16_t size_y_;
+    uint16_t explosion_radius_;
+    uint16_t bomb_timer_;
+    std::unordered_map<BombId, bomb_t> bombs_;
+    std::unordered_map<Position, uint16_t, position_hash> danger_; // number of bombs reaching the position
+    Position search_origin_;
+    std::vector<int16_t> distances_; // from the last search, -1 if not reached
+    std::vector<Direction> first_moves_; // from the last search
+};
+
+#endif //SIK_2022_BOT_H
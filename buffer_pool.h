@@ -0,0 +1,84 @@
+#ifndef SIK_2022_BUFFER_POOL_H
+#define SIK_2022_BUFFER_POOL_H
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define BUFFER_POOL_MIN_SIZE 512
+#define BUFFER_POOL_CLASSES 5 // 512 B, 2 KB, 8 KB, 32 KB, 128 KB
+#define BUFFER_POOL_KEPT_BUFFERS 64 // free buffers kept in each size class
+
+/* = = = = = = = = = = = = = *
+ * POOL OF RECEIVE BUFFERS   *
+ * = = = = = = = = = = = = = */
+
+/* Bufory są wypożyczane tylko na czas jednego odczytu z gniazda, więc liczba zajętych buforów
+ * zależy od liczby połączeń, które akurat przysłały dane, a nie od liczby wszystkich połączeń.
+ * Rozmiary buforów są potęgami 4 (klasy rozmiarów), zwolnione bufory wracają do listy swojej klasy. */
+class buffer_pool {
+public:
+    // Buffer borrowed from the pool, returned to it when destroyed
+    class buffer {
+    public:
+        buffer(buffer_pool *pool, size_t size_class, std::unique_ptr<char[]> memory)
+                : pool_(pool), size_class_(size_class), memory_(std::move(memory)) {}
+
+        buffer(buffer &&other) = default;
+        buffer &operator=(buffer &&other) = delete;
+
+        ~buffer() {
+            if (memory_)
+                pool_->give_back(size_class_, std::move(memory_));
+        }
+
+        char *data() {
+            return memory_.get();
+        }
+
+        size_t size() const {
+            return class_size(size_class_);
+        }
+
+    private:
+        buffer_pool *pool_;
+        size_t size_class_;
+        std::unique_ptr<char[]> memory_;
+    };
+
+    static size_t class_size(size_t size_class) {
+        return (size_t) BUFFER_POOL_MIN_SIZE << (2 * size_class);
+    }
+
+    // size_class has to be smaller than BUFFER_POOL_CLASSES
+    buffer take(size_t size_class) {
+        auto &free_list = free_lists_[size_class];
+        {
+            const std::lock_guard<std::mutex> lock(free_list.mutex);
+            if (!free_list.buffers.empty()) {
+                auto memory = std::move(free_list.buffers.back());
+                free_list.buffers.pop_back();
+                return buffer(this, size_class, std::move(memory));
+            }
+        }
+        return buffer(this, size_class, std::make_unique_for_overwrite<char[]>(class_size(size_class)));
+    }
+
+private:
+    void give_back(size_t size_class, std::unique_ptr<char[]> memory) {
+        auto &free_list = free_lists_[size_class];
+        const std::lock_guard<std::mutex> lock(free_list.mutex);
+        if (free_list.buffers.size() < BUFFER_POOL_KEPT_BUFFERS)
+            free_list.buffers.push_back(std::move(memory));
+    }
+
+    struct free_list_t {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<char[]>> buffers;
+    };
+
+    std::array<free_list_t, BUFFER_POOL_CLASSES> free_lists_;
+};
+
+#endif //SIK_2022_BUFFER_POOL_H
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <string>
+#include <thread>
 #include <boost/program_options.hpp>
 #include <boost/array.hpp>
 #include <boost/bind/bind.hpp>
@@ -7,25 +8,26 @@
 #include <boost/asio.hpp>
 
 #include "common.h"
+#include "tile_map.h"
+#include "spsc_queue.h"
+#include "buffer_pool.h"
+#include "bot.h"
+#include "tracer.h"
+#include "allocation_stats.h"
 
-#define BUFFER_SIZE 80000
+#define MAX_DATAGRAM_SIZE 65536
 
 using boost::asio::ip::udp;
 using boost::asio::ip::tcp;
 
 namespace p_opt = boost::program_options;
 
-std::pair<std::string, std::string> split_address(const std::string &address) {
-    size_t poss_to_split = address.find_last_of(':');
-    if (poss_to_split == std::string::npos) {
-        std::cout << "Incorrect address (" << address
-                  << ") format, use format: <(host name):(port) lub (IPv4):(port) lub (IPv6):(port)>" << std::endl;
-        exit(1);
-    }
-    auto ip = address.substr(0, poss_to_split);
-    auto port = address.substr(poss_to_split + 1);
-    return {ip, port};
-}
+// program parameters
+uint32_t seats_count;
+bool bot_mode;
+
+buffer_pool receive_buffers; // shared by all seats
+allocation_report allocations; // printed after each turn if built with ALLOCATION_STATS
 
 struct ClientGameInfo {
     // flags
@@ -45,11 +47,185 @@ struct ClientGameInfo {
     // only for game
     uint16_t turn;
     std::unordered_map<PlayerId, Player> players;
-    std::unordered_map<PlayerId, Position> player_positions;
-    std::unordered_map<PlayerId, Score> scores;
-    std::vector<Position> blocks;
-    std::unordered_map<BombId, Bomb> bombs;
+    player_table player_states; // positions and scores
+    tile_map blocks;
+    bomb_table bombs;
+    std::optional<PlayerId> own_id; // empty if the seat only watches the game
+    std::optional<bot_player> bot; // only in bot mode
+
+    /* Zmiana stanu po komunikacie serwera, stosowana przez wątek sieciowy i osobno przez wątek renderujący,
+     * który trzyma własną kopię stanu do rysowania. Nie zmienia join_sent, own_id ani bot.
+     * Pozycje objęte wybuchami tury są dodawane do explosions. */
+    void apply(const ServerMessage &message, std::set<Position> *explosions) {
+        switch (message.type) {
+            case ServerMessageType::Hello: {
+                auto &hello = get<server_message_hello_t>(message.variant);
+                hello_received = true;
+                server_name = hello.server_name;
+                player_count = hello.players_count;
+                size_x = hello.size_x;
+                size_y = hello.size_y;
+                game_length = hello.game_length;
+                explosion_radius = hello.explosion_radius;
+                bomb_timer = hello.bomb_timer;
+                break;
+            }
+
+            case ServerMessageType::AcceptedPlayer: {
+                auto &accepted_player = get<server_message_accepted_player_t>(message.variant);
+                players.insert({accepted_player.id, accepted_player.player});
+                break;
+            }
+
+            case ServerMessageType::GameStarted: {
+                auto &started = get<server_message_game_started_t>(message.variant);
+                game_started = true;
+                players = started.players;
+                for (auto &player: players) {
+                    player_states.add(player.first, {0, 0});
+                }
+                break;
+            }
+
+            case ServerMessageType::Turn: {
+                apply_turn(get<server_message_turn_t>(message.variant), explosions);
+                break;
+            }
 
+            case ServerMessageType::GameEnded: {
+                game_started = false; // game ended waiting for the next one
+                players = {};
+                player_states.clear();
+                bombs.clear();
+                blocks.clear();
+                break;
+            }
+        }
+    }
+
+    DrawMessage lobby_message() const {
+        return {
+                DrawMessageType::Lobby,
+                draw_message_lobby_t{
+                        server_name,
+                        player_count,
+                        size_x,
+                        size_y,
+                        game_length,
+                        explosion_radius,
+                        bomb_timer,
+                        players
+                }
+        };
+    }
+
+    DrawMessage game_message(const std::set<Position> &explosions) const {
+        std::vector<Bomb> bomb_vector;
+        for (size_t bomb = 0; bomb < bombs.size(); bomb++) {
+            bomb_vector.push_back({bombs.position(bomb), bombs.timer(bomb, turn)});
+        }
+
+        return {
+                DrawMessageType::Game,
+                draw_message_game_t({
+                                            server_name,
+                                            size_x,
+                                            size_y,
+                                            game_length,
+                                            turn,
+                                            players,
+                                            player_states.positions_map(),
+                                            blocks.positions(),
+                                            bomb_vector,
+                                            std::vector<Position>(explosions.begin(), explosions.end()),
+                                            player_states.scores_map(),
+                                    })
+        };
+    }
+
+private:
+    void apply_turn(const server_message_turn_t &turn_message, std::set<Position> *explosions) {
+        std::set<PlayerId> destroyed_players;
+        std::set<Position> destroyed_blocks;
+
+        // before processing events
+        turn = turn_message.turn;
+
+        // processing events
+        for (auto &event: turn_message.events) {
+            switch (event.type) {
+                case EventType::BlockPlaced: {
+                    auto &event_desc = get<event_block_placed_t>(event.variant);
+                    blocks.insert(event_desc.position);
+                    break;
+                }
+
+                case EventType::BombPlaced: {
+                    auto &event_desc = get<event_bomb_placed_t>(event.variant);
+                    // Server is always right, if bomb with this id exists it is replaced with new one
+                    bombs.add(event_desc.id, event_desc.position, (uint32_t) turn + bomb_timer);
+                    break;
+                }
+
+                case EventType::PlayerMoved: {
+                    auto &event_desc = get<event_player_moved_t>(event.variant);
+                    if (player_states.contains(event_desc.id))
+                        player_states.set_position(event_desc.id, event_desc.position);
+                    // else: move of unknown player, do nothing
+                    break;
+                }
+
+                case EventType::BombExploded: {
+                    auto &event_desc = get<event_bomb_exploded_t>(event.variant);
+                    auto bomb_index = bombs.find(event_desc.id);
+                    if (bomb_index != bombs.size()) {
+                        auto center = bombs.position(bomb_index);
+                        explosions->insert(center);
+
+
+                        if (!blocks.contains(center)) {
+                            std::vector<std::pair<int, int>> directions = {{1,  0},
+                                                                           {-1, 0},
+                                                                           {0,  1},
+                                                                           {0,  -1}};
+                            for (auto &direction: directions) {
+                                for (int i = 1; i <= explosion_radius; i++) {
+                                    Position new_explosion = {center.first + direction.first * i,
+                                                              center.second + direction.second * i};
+                                    if (new_explosion.first >= size_x ||
+                                        new_explosion.second >= size_y) {
+                                        break;
+                                    }
+                                    explosions->insert(new_explosion);
+                                    if (blocks.contains(new_explosion))
+                                        break;
+                                }
+                            }
+                        }
+                        bombs.erase(event_desc.id);
+                    } // else unknown bomb, position unknown
+                    for (auto &destroyed_block: event_desc.blocks_destroyed) {
+                        destroyed_blocks.insert(destroyed_block);
+                    }
+                    for (auto &destroyed_player: event_desc.robots_destroyed) {
+                        destroyed_players.insert(destroyed_player);
+                    }
+                    break;
+                }
+            }
+
+
+        }
+        // after processing all events
+        for (auto &increase_score: destroyed_players) {
+            if (player_states.contains(increase_score))
+                player_states.scores[increase_score] += 1;
+        }
+        //remove destroyed blocks
+        for (auto &block: destroyed_blocks) {
+            blocks.erase(block);
+        }
+    }
 };
 
 ClientMessage client_message_from_input_message(const InputMessage &input_message) {
@@ -63,395 +239,385 @@ ClientMessage client_message_from_input_message(const InputMessage &input_messag
         }
 
         case InputMessageType::Move: {
-            return ClientMessage({ClientMessageType::Move, input_message.direction});
+            return ClientMessage({ClientMessageType::Move, std::get<Direction>(input_message.variant)});
         }
     }
     std::cerr << "Error: client_message_from_input_message impossible input_message type" << std::endl;
     exit(1);
 }
 
+/* Jeden obiekt client_server to jedno miejsce (seat): połączenie z serwerem, nazwa gracza i opcjonalnie GUI.
+ * Wiele miejsc może działać w jednym procesie na wspólnej puli wątków io_context - obsługa jednego
+ * miejsca jest serializowana przez jego strand. Bufory do odczytu są pożyczane tylko na czas odczytu,
+ * a klatki dla GUI są budowane na wspólnej puli wątków renderujących. Miejsce bez GUI dołącza do gry samo. */
 class client_server {
 public:
-    client_server(boost::asio::io_context &io_context, uint16_t receive_gui_port, const std::string &server_address,
-                  const std::string &server_port,
-                  const std::string &gui_address, const std::string &gui_port, const std::string &player_name)
-            : udp_resolver_(io_context), gui_address_(gui_address), gui_port_(gui_port),
-            gui_socket_(io_context, udp::endpoint(udp::v6(), receive_gui_port)),
-            server_socket_(io_context), player_name(player_name) {
-
-        tcp::resolver resolver(io_context);
-        tcp::resolver::results_type server_endpoints;
-        try {
-            // try finding ip v4 endpoint
-            server_endpoints = resolver.resolve(server_address, server_port);
-        } catch (std::exception &e) {
-            std::cerr << "Error: resolving server address failed" << std::endl;
-            exit(1);
-        }
+    struct gui_endpoints {
+        uint16_t receive_port;
+        std::string address;
+        std::string port;
+    };
+
+    client_server(boost::asio::io_context &io_context, const tcp::resolver::results_type &server_endpoints,
+                  const std::string &player_name, const std::optional<gui_endpoints> &gui,
+                  boost::asio::thread_pool *render_pool)
+            : strand_(boost::asio::make_strand(io_context)), server_socket_(strand_), player_name(player_name) {
         try {
             boost::asio::connect(server_socket_, server_endpoints);
         } catch (std::exception &e) {
-            std::cerr << "Error: connecting to server failed" << std::endl;
-            exit(1);
+            fail("connecting to server failed");
+            return;
         }
 
         boost::asio::ip::tcp::no_delay no_delay_option(true);
         server_socket_.set_option(no_delay_option);
 
-        start_receive_from_gui();
+        if (gui) {
+            gui_.emplace(strand_, gui.value());
+            gui_->socket.non_blocking(true);
+            start_receive_from_gui();
+            render_strand_.emplace(boost::asio::make_strand(*render_pool));
+        }
         start_receive_from_server();
     }
 
 private:
+    struct gui_t {
+        gui_t(boost::asio::strand<boost::asio::io_context::executor_type> &strand, const gui_endpoints &endpoints)
+                : socket(strand, udp::endpoint(udp::v6(), endpoints.receive_port)),
+                  send_socket(strand), resolver(strand), address(endpoints.address), port(endpoints.port) {}
+
+        udp::socket socket;
+        udp::endpoint remote_endpoint;
+        udp::socket send_socket; // used only on the render strand
+        udp::endpoint endpoint;
+        udp::resolver resolver; // used only on the render strand
+        std::string address;
+        std::string port;
+    };
+
+    // With one seat every error ends the program, with many seats only the seat is closed
+    void fail(const std::string &message) {
+        std::cerr << "Error: " << message << (seats_count > 1 ? " (" + player_name + ")" : "") << std::endl;
+        if (seats_count == 1)
+            exit(1);
+        boost::system::error_code ignored_error;
+        server_socket_.close(ignored_error);
+        if (gui_)
+            gui_->socket.close(ignored_error);
+    }
+
     void start_receive_from_gui() {
-        gui_socket_.async_receive_from(
-                boost::asio::buffer(gui_recv_buffer_), gui_remote_endpoint_,
+        gui_->socket.async_wait(
+                udp::socket::wait_read,
                 boost::bind(&client_server::handle_receive_from_gui, this,
-                            boost::asio::placeholders::error,
-                            boost::asio::placeholders::bytes_transferred));
+                            boost::asio::placeholders::error));
     }
 
+    // Waits until data can be read without taking any buffer
     void start_receive_from_server() {
-        server_socket_.async_receive(
-                boost::asio::buffer(server_recv_buffer_),
+        server_socket_.async_wait(
+                tcp::socket::wait_read,
                 boost::bind(&client_server::handle_receive_from_server, this,
-                            boost::asio::placeholders::error,
-                            boost::asio::placeholders::bytes_transferred));
+                            boost::asio::placeholders::error));
     }
 
     void send_join() {
-        char buff[BUFFER_SIZE];
-        char *buff_ptr = buff;
-        size_t buff_size = BUFFER_SIZE;
-        assert(serialize(ClientMessage({
-                                               ClientMessageType::Join,
-                                               player_name
-                                       }), &buff_ptr, &buff_size));
-        try {
-            boost::asio::write(server_socket_, boost::asio::buffer(buff, BUFFER_SIZE - buff_size));
-        } catch (std::exception &e) {
-            // error sending to server
-            std::cerr << "Error: sending message to server failed" << std::endl;
-            exit(1);
+        send_to_server(ClientMessage({ClientMessageType::Join, player_name}));
+    }
+
+    // Returns false if sending failed and the seat was closed
+    bool send_to_server(const ClientMessage &message) {
+        auto encoded = message_buffer::encode_block(message);
+        boost::system::error_code error;
+        boost::asio::write(server_socket_, boost::asio::buffer(*encoded), error);
+        if (error) { // error sending to server
+            fail("sending message to server failed");
+            return false;
         }
+        return true;
     }
 
-    void handle_receive_from_gui(const boost::system::error_code &error,
-                                 std::size_t bytes_transferred) {
-        if (!error) {
-            auto bytes_left = bytes_transferred;
-            char *buff_to_read = gui_recv_buffer_.c_array();
-            auto received_message = parse<InputMessage>(&buff_to_read, &bytes_left);
-            if (received_message && bytes_left == 0) {
-                // after receiving anny correct message try joining if not in game
-                client_game_info_mutex.lock();
-                if (client_game_info.hello_received && !client_game_info.game_started) {
-                    client_game_info_mutex.unlock();
-
-                    send_join();
-
-                    start_receive_from_gui();
-                    return;
-                } else {
-                    client_game_info_mutex.unlock();
-                }
+    void handle_receive_from_gui(const boost::system::error_code &error) {
+        if (error == boost::asio::error::operation_aborted) {
+            return; // seat was closed
+        } else if (error) {
+            fail("receiving message from gui failed");
+            return;
+        }
 
-                ClientMessage client_message = client_message_from_input_message(received_message.value());
+        boost::system::error_code read_error;
+        std::optional<InputMessage> received_message;
+        size_t bytes_left;
+        {
+            // Buffer fits any datagram, so a too long message is never cut to a correct one
+            auto buffer = receive_buffers.take(BUFFER_POOL_CLASSES - 1);
+            static_assert(MAX_DATAGRAM_SIZE <= BUFFER_POOL_MIN_SIZE << (2 * (BUFFER_POOL_CLASSES - 1)));
+            bytes_left = gui_->socket.receive_from(boost::asio::buffer(buffer.data(), buffer.size()),
+                                                   gui_->remote_endpoint, 0, read_error);
+            char *buff_to_read = buffer.data();
+            if (!read_error)
+                received_message = parse<InputMessage>(&buff_to_read, &bytes_left);
+        }
+        if (read_error == boost::asio::error::would_block) {
+            start_receive_from_gui();
+            return;
+        } else if (read_error) {
+            fail("receiving message from gui failed");
+            return;
+        }
+
+        if (received_message && bytes_left == 0) {
+            // after receiving anny correct message try joining if not in game
+            client_game_info_mutex.lock();
+            if (client_game_info.hello_received && !client_game_info.game_started) {
+                client_game_info_mutex.unlock();
 
-                char buff[BUFFER_SIZE];
-                size_t buff_size = BUFFER_SIZE;
-                char *buff_to_write = buff;
-                assert(serialize(client_message, &buff_to_write, &buff_size));
-                server_socket_.send(boost::asio::buffer(buff, BUFFER_SIZE - buff_size));
+                send_join();
+
+                start_receive_from_gui();
+                return;
+            } else {
+                client_game_info_mutex.unlock();
             }
-            start_receive_from_gui();
-        } else {
-            std::cerr << "Error: receiving message from gui failed" << std::endl;
-            exit(1);
+
+            if (!send_to_server(client_message_from_input_message(received_message.value())))
+                return;
         }
+        start_receive_from_gui();
     }
 
-    void handle_receive_from_server(const boost::system::error_code &error,
-                                    std::size_t bytes_transferred) {
-        if (error == boost::asio::error::eof) {
-            std::cerr << "Error: connection with server closed" << std::endl;
-            exit(1);
+    void handle_receive_from_server(const boost::system::error_code &error) {
+        if (error == boost::asio::error::operation_aborted) {
+            return; // seat was closed
         } else if (error) {
-            std::cerr << "Error: receiving message from server failed" << std::endl;
-            exit(1);
+            fail("receiving message from server failed");
+            return;
+        }
+        trace_span span("handle receive");
+
+        // Socket stays blocking, because messages to the server are sent with synchronous writes.
+        // It is readable now, so receive returns at once: with the data or with eof if nothing is available.
+        boost::system::error_code read_error;
+        {
+            auto buffer = receive_buffers.take(server_read_size_class_);
+            auto bytes_transferred = server_socket_.receive(boost::asio::buffer(buffer.data(), buffer.size()), 0,
+                                                            read_error);
+            if (!read_error)
+                server_stream_.append(buffer.data(), bytes_transferred);
+            // Bigger buffer next time if this one was filled, smaller if it was mostly empty
+            if (bytes_transferred == buffer.size() && server_read_size_class_ + 1 < BUFFER_POOL_CLASSES)
+                server_read_size_class_++;
+            else if (bytes_transferred < buffer.size() / 4 && server_read_size_class_ > 0)
+                server_read_size_class_--;
+        }
+        if (read_error == boost::asio::error::eof) {
+            fail("connection with server closed");
+            return;
+        } else if (read_error) {
+            fail("receiving message from server failed");
+            return;
         }
 
-        server_saved_buffer_ += std::string(server_recv_buffer_.c_array(), bytes_transferred);
-
-        while (!server_saved_buffer_.empty()) {
-            char *buff = server_saved_buffer_.data();
-            auto bytes_to_read = (size_t) server_saved_buffer_.size();
-            auto server_message = parse<ServerMessage>(&buff, &bytes_to_read);
-            if (!server_message && bytes_to_read == 0) {
+        ServerMessage server_message;
+        while (true) {
+            scan_status status;
+            {
+                trace_span parse_span("parse");
+                allocation_phase_scope phase(AllocationPhase::Parse);
+                status = server_stream_.next(&server_message);
+            }
+            if (status == scan_status::incomplete) {
                 // Part of the message hasn't been received yet, waiting for the rest of it
                 break;
-            } else if (!server_message) {
+            } else if (status == scan_status::invalid) {
                 // Message was incorrect, disconnect
-                std::cerr << "Error: incorrect message from server" << std::endl;
-                exit(1);
+                fail("incorrect message from server");
+                return;
             }
             // Correct message
-            auto parsed_size = (size_t) (buff - server_saved_buffer_.data());
-            server_saved_buffer_.erase(0, parsed_size);
-            process_server_message(server_message.value());
+            std::optional<uint16_t> turn;
+            if (server_message.type == ServerMessageType::Turn)
+                turn = std::get<server_message_turn_t>(server_message.variant).turn;
+            process_server_message(server_message);
+            if (turn)
+                allocations.print(turn.value());
         }
+        server_stream_.shrink();
+
+        if (!gui_ || bot_mode) // nobody will press a key, so seat without gui joins by itself
+            join_if_in_lobby();
 
         start_receive_from_server();
     }
 
+    void join_if_in_lobby() {
+        const std::lock_guard<std::mutex> client_game_info_lock(client_game_info_mutex);
+        if (client_game_info.hello_received && !client_game_info.game_started && !client_game_info.join_sent) {
+            client_game_info.join_sent = true;
+            send_join();
+        }
+    }
+
     void handle_send(boost::shared_ptr<std::string> /*message*/,
                      const boost::system::error_code & /*error*/,
                      std::size_t /*bytes_transferred*/) {}
 
-    // lock client_game_info before calling this method
-    void send_lobby_message() {
-        DrawMessage to_send = {
-                DrawMessageType::Lobby,
-                draw_message_lobby_t{
-                        client_game_info.server_name,
-                        client_game_info.player_count,
-                        client_game_info.size_x,
-                        client_game_info.size_y,
-                        client_game_info.game_length,
-                        client_game_info.explosion_radius,
-                        client_game_info.bomb_timer,
-                        client_game_info.players
-                }
-        };
+    // Message is applied to the state of the game kept on the render strand, so the io_context thread
+    // never builds frames and receiving from server never waits for the gui
+    void send_to_gui(ServerMessage &&message) {
+        messages_.push(std::move(message));
+        // One frame is scheduled at a time, messages pushed before it runs are drawn in that frame
+        if (!render_scheduled_.exchange(true, std::memory_order_acq_rel))
+            boost::asio::post(render_strand_.value(), [this]() { render_frame(); });
+    }
+
+    /* Na strandzie renderującym miejsca stosowane są do jego kopii stanu gry wszystkie czekające
+     * komunikaty, a potem budowana i wysyłana jest tylko jedna klatka dla najnowszego stanu. Wybuchy
+     * wszystkich tur od ostatniej wysłanej klatki tej samej gry trafiają do wysyłanej klatki, więc GUI
+     * pokazuje każdy wybuch, nawet gdy nie nadąża z odbieraniem tur. */
+    void render_frame() {
+        trace_thread_name("render");
+        // Acquire pairs with send_to_gui, so messages pushed before scheduling this frame are popped below
+        render_scheduled_.exchange(false, std::memory_order_acq_rel);
+        std::optional<DrawMessage> lobby_frame;
+        bool game_frame = false;
+        ServerMessage message;
+        while (messages_.pop(&message)) {
+            trace_span span("apply message");
+            allocation_phase_scope phase(AllocationPhase::DrawBuild);
+            draw_info_.apply(message, &explosions_);
+            if (message.type == ServerMessageType::Turn) {
+                game_frame = true;
+            } else if (message.type != ServerMessageType::GameStarted) { // game started isn't drawn
+                lobby_frame = draw_info_.lobby_message();
+                game_frame = false;
+                explosions_.clear();
+            }
+        }
+        if (game_frame) {
+            DrawMessage frame;
+            {
+                trace_span span("build frame");
+                allocation_phase_scope phase(AllocationPhase::DrawBuild);
+                frame = draw_info_.game_message(explosions_);
+            }
+            explosions_.clear();
+            send_frame(frame);
+        } else if (lobby_frame) {
+            send_frame(lobby_frame.value());
+        }
+    }
 
-        char send_buffer[BUFFER_SIZE];
-        char *write_ptr = send_buffer;
-        size_t bytes_to_write = BUFFER_SIZE;
-        assert(serialize(to_send, &write_ptr, &bytes_to_write));
+    void send_frame(const DrawMessage &message) {
+        trace_span span("send frame");
+        message_buffer send_buffer;
+        {
+            allocation_phase_scope phase(AllocationPhase::Encode);
+            [[maybe_unused]] bool serialized = serialize(message, send_buffer);
+            assert(serialized);
+        }
 
         try {
-            auto endpoint = *udp_resolver_.resolve(gui_address_, gui_port_).begin();
-            gui_socket_.send_to(boost::asio::buffer(send_buffer, BUFFER_SIZE - bytes_to_write), endpoint);
+            if (!gui_->send_socket.is_open()) {
+                gui_->endpoint = *gui_->resolver.resolve(gui_->address, gui_->port).begin();
+                gui_->send_socket.open(gui_->endpoint.protocol());
+            }
+            gui_->send_socket.send_to(send_buffer.buffers<boost::asio::const_buffer>(), gui_->endpoint);
         } catch (std::exception &e) {
             std::cerr << "Error: sending message to gui failed" << std::endl;
         }
     }
 
-    bool check_if_block_on_position(Position position) {
-        for (auto &block: client_game_info.blocks) {
-            if (block == position) {
-                return true;
-            }
+    // Bot learns what changed after all events of the turn were applied and answers with its action.
+    // You need to have client_game_info_mutex to run this function
+    void play_bot_turn(const server_message_turn_t &turn) {
+        trace_span span("bot");
+        auto &bot = client_game_info.bot.value();
+        bot.turn_events(turn.events, client_game_info.blocks);
+
+        auto own_id = client_game_info.own_id.value();
+        if (!client_game_info.player_states.contains(own_id))
+            return;
+        std::vector<Position> enemies;
+        for (auto id: client_game_info.player_states.ids) {
+            if (id != own_id)
+                enemies.push_back(client_game_info.player_states.position(id));
         }
-        return false;
+        auto action = bot.choose_action(client_game_info.player_states.position(own_id), enemies,
+                                        client_game_info.blocks);
+        if (action)
+            send_to_server(action.value());
     }
 
-    void process_server_message(const ServerMessage &message) {
+    void process_server_message(ServerMessage &message) {
         const std::lock_guard<std::mutex> client_game_info_lock(client_game_info_mutex);
-        if (message.type == ServerMessageType::Hello && !client_game_info.hello_received) {
-            auto hello = get<server_message_hello_t>(message.variant);
-            client_game_info.hello_received = true;
-            client_game_info.server_name = hello.server_name;
-            client_game_info.player_count = hello.players_count;
-            client_game_info.size_x = hello.size_x;
-            client_game_info.size_y = hello.size_y;
-            client_game_info.game_length = hello.game_length;
-            client_game_info.explosion_radius = hello.explosion_radius;
-            client_game_info.bomb_timer = hello.bomb_timer;
-
-            send_lobby_message();
-            return;
-
-        } else if (message.type == ServerMessageType::Hello || !client_game_info.hello_received)
-            return; // Ignore more than one hello message or any other message before receiving hello
+        trace_span span("process message");
+        if (message.type == ServerMessageType::Hello && client_game_info.hello_received)
+            return; // Ignore more than one hello message
+        if (message.type != ServerMessageType::Hello && !client_game_info.hello_received)
+            return; // Ignore any other message before receiving hello
+
+        if (message.type == ServerMessageType::Turn && !client_game_info.bot) {
+            // Without a bot the state of the game is needed only for drawing, turns are applied on the render strand
+            client_game_info.turn = get<server_message_turn_t>(message.variant).turn;
+        } else {
+            allocation_phase_scope phase(AllocationPhase::TurnCompute);
+            std::set<Position> explosions;
+            client_game_info.apply(message, &explosions);
+        }
 
         switch (message.type) {
-            case ServerMessageType::AcceptedPlayer: {
-                auto accepted_player = get<server_message_accepted_player_t>(message.variant);
-                client_game_info.players.insert({accepted_player.id, accepted_player.player});
-
-                // Send lobby message to gui
-                send_lobby_message();
-
-                break;
-            }
-
             case ServerMessageType::GameStarted: {
-                auto game_started = get<server_message_game_started_t>(message.variant);
-                client_game_info.game_started = true;
-                client_game_info.players = move(game_started.players);
                 for (auto &player: client_game_info.players) {
-                    client_game_info.player_positions.insert({player.first, {0, 0}});
-                    client_game_info.scores.insert({player.first, 0});
+                    if (player.second.first == player_name)
+                        client_game_info.own_id = player.first;
                 }
+                if (bot_mode && client_game_info.own_id)
+                    client_game_info.bot.emplace(client_game_info.size_x, client_game_info.size_y,
+                                                 client_game_info.explosion_radius, client_game_info.bomb_timer);
                 break;
             }
 
             case ServerMessageType::Turn: {
-                std::set<Position> explosions;
-                std::set<PlayerId> destroyed_players;
-                std::set<Position> destroyed_blocks;
-
-                auto turn = get<server_message_turn_t>(message.variant);
-
-                // before processing events
-                client_game_info.turn = turn.turn;
-                for (auto &bomb: client_game_info.bombs) {
-                    bomb.second.second -= 1; // tick bomb timer
-                }
-
-                // processing events
-                for (auto &event: turn.events) {
-                    switch (event.type) {
-                        case EventType::BlockPlaced: {
-                            auto event_desc = get<event_block_placed_t>(event.variant);
-                            if (std::find(client_game_info.blocks.begin(), client_game_info.blocks.end(),
-                                          event_desc.position) == client_game_info.blocks.end())
-                                client_game_info.blocks.push_back(event_desc.position);
-                            break;
-                        }
-
-                        case EventType::BombPlaced: {
-                            auto event_desc = get<event_bomb_placed_t>(event.variant);
-                            Bomb bomb = {event_desc.position, client_game_info.bomb_timer};
-                            if (client_game_info.bombs.contains(event_desc.id)) {
-                                // Server is always right, bomb with this id was just placed (replace it with new one)
-                                client_game_info.bombs[event_desc.id] = bomb;
-                            } else {
-                                client_game_info.bombs.insert({event_desc.id, bomb});
-                            }
-                            break;
-                        }
-
-                        case EventType::PlayerMoved: {
-                            auto event_desc = get<event_player_moved_t>(event.variant);
-                            if (client_game_info.player_positions.contains(event_desc.id))
-                                client_game_info.player_positions[event_desc.id] = event_desc.position;
-                            // else: move of unknown player, do nothing
-                            break;
-                        }
-
-                        case EventType::BombExploded: {
-                            auto event_desc = get<event_bomb_exploded_t>(event.variant);
-                            if (client_game_info.bombs.contains(event_desc.id)) {
-                                auto center = client_game_info.bombs[event_desc.id].first;
-                                explosions.insert(center);
-
-
-                                if (!check_if_block_on_position(center)) {
-                                    std::vector<std::pair<int, int>> directions = {{1,  0},
-                                                                                   {-1, 0},
-                                                                                   {0,  1},
-                                                                                   {0,  -1}};
-                                    for (auto &direction: directions) {
-                                        for (int i = 1; i <= client_game_info.explosion_radius; i++) {
-                                            Position new_explosion = {center.first + direction.first * i,
-                                                                      center.second + direction.second * i};
-                                            if (new_explosion.first >= client_game_info.size_x ||
-                                                new_explosion.second >= client_game_info.size_y) {
-                                                break;
-                                            }
-                                            explosions.insert(new_explosion);
-                                            if (check_if_block_on_position(new_explosion))
-                                                break;
-                                        }
-                                    }
-                                }
-                                client_game_info.bombs.erase(event_desc.id);
-                            } // else unknown bomb, position unknown
-                            for (auto &destroyed_block: event_desc.blocks_destroyed) {
-                                destroyed_blocks.insert(destroyed_block);
-                            }
-                            for (auto &destroyed_player: event_desc.robots_destroyed) {
-                                destroyed_players.insert(destroyed_player);
-                            }
-                            break;
-                        }
-                    }
-
-
-                }
-                // after processing all events
-                for (auto &increase_score: destroyed_players) {
-                    client_game_info.scores[increase_score] += 1;
-                }
-                //remove destroyed blocks
-                for (auto &block: destroyed_blocks) {
-                    remove_from_vector(client_game_info.blocks, block);
-                }
-
-                std::vector<Bomb> bomb_vector;
-                for (auto &bomb: client_game_info.bombs) {
-                    bomb_vector.push_back(bomb.second);
-                }
-
-                DrawMessage to_send = {
-                        DrawMessageType::Game,
-                        draw_message_game_t({
-                                                    client_game_info.server_name,
-                                                    client_game_info.size_x,
-                                                    client_game_info.size_y,
-                                                    client_game_info.game_length,
-                                                    client_game_info.turn,
-                                                    client_game_info.players,
-                                                    client_game_info.player_positions,
-                                                    client_game_info.blocks,
-                                                    bomb_vector,
-                                                    std::vector<Position>(explosions.begin(), explosions.end()),
-                                                    client_game_info.scores,
-                                            })
-                };
-
-                char send_buffer[BUFFER_SIZE];
-                char *write_ptr = send_buffer;
-                size_t bytes_to_write = BUFFER_SIZE;
-                assert(serialize(to_send, &write_ptr, &bytes_to_write));
-
-
-                try {
-                    auto endpoint = *udp_resolver_.resolve(gui_address_, gui_port_).begin();
-                    gui_socket_.send_to(boost::asio::buffer(send_buffer, BUFFER_SIZE - bytes_to_write), endpoint);
-                } catch (std::exception &e) {
-                    std::cerr << "Error: sending message to gui failed" << std::endl;
-                }
+                if (client_game_info.bot)
+                    play_bot_turn(get<server_message_turn_t>(message.variant));
                 break;
             }
 
             case ServerMessageType::GameEnded: {
-                auto game_ended = get<server_message_game_ended_t>(message.variant);
-                client_game_info.game_started = false; // game ended waiting for the next one
-                client_game_info.players = {};
-                client_game_info.player_positions = {};
-                client_game_info.scores = {};
-                client_game_info.bombs = {};
-                client_game_info.blocks = {};
-
-                send_lobby_message();
+                client_game_info.join_sent = false;
+                client_game_info.own_id.reset();
+                client_game_info.bot.reset();
                 break;
             }
 
-            case ServerMessageType::Hello: {
-                assert(false);
+            default:
                 break;
-            }
         }
+
+        if (gui_)
+            send_to_gui(std::move(message));
     }
 
-    udp::resolver udp_resolver_;
-    std::string gui_address_;
-    std::string gui_port_;
-    udp::socket gui_socket_;
-    udp::endpoint gui_remote_endpoint_;
-    boost::array<char, BUFFER_SIZE> gui_recv_buffer_;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    std::optional<gui_t> gui_; // empty if seat has no gui
 
     tcp::socket server_socket_;
-    boost::array<char, BUFFER_SIZE> server_recv_buffer_;
-    std::string server_saved_buffer_;
+    size_t server_read_size_class_ = 0; // of buffer taken from receive_buffers
+    stream_parser<ServerMessage> server_stream_;
 
     std::mutex client_game_info_mutex;
     ClientGameInfo client_game_info;
 
     std::string player_name;
+
+    // Empty if seat has no gui, runs frames of this seat one at a time on the shared render pool
+    std::optional<boost::asio::strand<boost::asio::thread_pool::executor_type>> render_strand_;
+    spsc_queue<ServerMessage> messages_; // pushed by the io_context thread, popped on the render strand
+    std::atomic<bool> render_scheduled_ = false;
+    ClientGameInfo draw_info_; // used only on the render strand
+    std::set<Position> explosions_; // since the last game frame, used only on the render strand
 };
 
 int main(int argc, char *argv[]) {
@@ -459,6 +625,9 @@ int main(int argc, char *argv[]) {
     std::string gui_address;
     std::string server_address;
     uint16_t port;
+    uint16_t threads_count;
+    uint16_t render_threads_count;
+    std::string trace_file;
 
     p_opt::options_description description("Allowed options");
     description.add_options()
@@ -468,7 +637,18 @@ int main(int argc, char *argv[]) {
             ("player-name,n", p_opt::value<std::string>(&player_name), "Nazwa gracza")
             ("port,p", p_opt::value<uint16_t>(&port), "Port na którym klient nasłuchuje komunikatów od GUI")
             ("server-address,s", p_opt::value<std::string>(&server_address),
-             "<(nazwa hosta):(port) lub (IPv4):(port) lub (IPv6):(port)>");
+             "<(nazwa hosta):(port) lub (IPv4):(port) lub (IPv6):(port)>")
+            ("seats", p_opt::value<uint32_t>(&seats_count)->default_value(1),
+             "(opcjonalny) liczba graczy obsługiwanych przez proces, gracz i ma nazwę (nazwa gracza)i, "
+             "a jego GUI używa portów powiększonych o i; przy wielu graczach GUI jest opcjonalne")
+            ("threads", p_opt::value<uint16_t>(&threads_count)->default_value(1),
+             "(opcjonalny) liczba wątków obsługujących połączenia wszystkich graczy")
+            ("render-threads", p_opt::value<uint16_t>(&render_threads_count)->default_value(1),
+             "(opcjonalny) liczba wątków budujących i wysyłających klatki do GUI wszystkich graczy")
+            ("bot", p_opt::bool_switch(&bot_mode),
+             "(opcjonalny) gracze grają sami zamiast czekać na komunikaty od GUI, GUI jest wtedy opcjonalne")
+            ("trace", p_opt::value<std::string>(&trace_file),
+             "(opcjonalny) plik, do którego zapisywane są czasy obsługi komunikatów (format Chrome trace event)");
 
     p_opt::variables_map var_map;
     p_opt::store(p_opt::parse_command_line(argc, argv, description), var_map);
@@ -479,16 +659,27 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    if (var_map.count("gui-address") == 0) {
+    if (seats_count == 0) {
+        std::cout << "No seats\n";
+        return 1;
+    }
+
+    bool use_gui = (seats_count == 1 && !bot_mode) || var_map.count("gui-address") != 0;
+    if (use_gui && var_map.count("gui-address") == 0) {
         std::cout << "No gui address\n";
         return 1;
     }
 
-    if (var_map.count("port") == 0) {
+    if (use_gui && var_map.count("port") == 0) {
         std::cout << "No gui port\n";
         return 1;
     }
 
+    if (use_gui && render_threads_count == 0) {
+        std::cout << "No render threads\n";
+        return 1;
+    }
+
     if (var_map.count("server-address") == 0) {
         std::cout << "No server address\n";
         return 1;
@@ -501,14 +692,65 @@ int main(int argc, char *argv[]) {
 
     boost::asio::io_context io_context;
     auto split_server_address = split_address(server_address);
-    auto split_gui_address = split_address(gui_address);
-    client_server client_server(io_context, port,
-                                split_server_address.first,
-                                split_server_address.second,
-                                split_gui_address.first,
-                                split_gui_address.second,
-                                player_name);
+    tcp::resolver resolver(io_context);
+    tcp::resolver::results_type server_endpoints;
+    try {
+        server_endpoints = resolver.resolve(split_server_address.first, split_server_address.second);
+    } catch (std::exception &e) {
+        std::cerr << "Error: resolving server address failed" << std::endl;
+        return 1;
+    }
+
+    std::optional<client_server::gui_endpoints> gui;
+    uint16_t gui_port = 0;
+    if (use_gui) {
+        auto split_gui_address = split_address(gui_address);
+        gui = {port, split_gui_address.first, split_gui_address.second};
+        if (seats_count > 1) { // ports of next seats are computed, so gui port has to be a number
+            try {
+                gui_port = boost::lexical_cast<uint16_t>(split_gui_address.second);
+            } catch (std::exception &e) {
+                std::cout << "Gui port has to be a number when there are many seats\n";
+                return 1;
+            }
+        }
+    }
+
+    std::unique_ptr<trace_writer> tracer; // destroyed after seats, so it gets all their spans
+    if (!trace_file.empty()) {
+        tracer = std::make_unique<trace_writer>(trace_file, "robots-client");
+        if (!tracer->is_open()) {
+            std::cerr << "Error: opening trace file failed" << std::endl;
+            return 1;
+        }
+    }
+
+    std::optional<boost::asio::thread_pool> render_pool; // shared by gui of all seats
+    if (use_gui)
+        render_pool.emplace(render_threads_count);
+
+    std::vector<std::unique_ptr<client_server>> seats;
+    for (uint32_t seat = 0; seat < seats_count; seat++) {
+        if (gui && seat > 0) {
+            gui->receive_port = (uint16_t) (port + seat);
+            gui->port = std::to_string((uint16_t) (gui_port + seat));
+        }
+        seats.push_back(std::make_unique<client_server>(
+                io_context, server_endpoints,
+                seats_count == 1 ? player_name : player_name + std::to_string(seat), gui,
+                render_pool ? &render_pool.value() : nullptr));
+    }
+
+    std::vector<std::thread> threads;
+    for (uint16_t i = 1; i < threads_count; i++) {
+        threads.emplace_back([&io_context]() { io_context.run(); });
+    }
     io_context.run();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (render_pool)
+        render_pool->join(); // frames use seats, so they have to be sent before seats are destroyed
 
-    return 0;
-}
\ No newline at end of file
+    return 1; // all seats were closed
+}
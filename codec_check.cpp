@@ -0,0 +1,145 @@
+#include <iostream>
+#include <string>
+#include <random>
+#include <boost/program_options.hpp>
+
+#include "common.h"
+
+namespace p_opt = boost::program_options;
+
+// program parameters
+uint32_t inputs_count;
+uint32_t seed;
+uint16_t max_length;
+
+/* = = = = = = = = = = = = = = = = = = *
+ * CHECK OF THE TWO-PHASE DECODER      *
+ * = = = = = = = = = = = = = = = = = = */
+
+/* Losowe ciągi bajtów (z przewagą małych wartości, żeby często były poprawnymi komunikatami)
+ * są dekodowane na dwa sposoby:
+ *  - parse: message_scanner sprawdza cały bufor naraz, potem decode_unchecked,
+ *  - stream_parser: ten sam bufor dopisywany losowymi kawałkami, skanowanie wznawiane po każdym kawałku.
+ * Oba muszą dać ten sam wynik: komunikat niepełny, niepoprawny albo ten sam komunikat o tej samej długości
+ * (wartości są porównywane przez ich zakodowane bajty). Każdy poprawny komunikat jest też kodowany
+ * i parsowany ponownie - musi zająć cały zakodowany bufor i mieć ten sam rozmiar. Bajty nie są tu
+ * porównywane, bo powtórzone klucze map są scalane, a mapa zbudowana od nowa może mieć inną kolejność. */
+
+std::mt19937 rng;
+
+template<typename T>
+std::string encode(const T &value) {
+    std::string result(encoded_size(value), '\0');
+    char *buffer = result.data();
+    size_t bytes_to_write = result.size();
+    [[maybe_unused]] bool serialized = serialize(value, &buffer, &bytes_to_write);
+    assert(serialized && bytes_to_write == 0);
+    return result;
+}
+
+std::string random_input() {
+    std::string input(rng() % (max_length + 1), '\0');
+    for (auto &byte : input) {
+        byte = (char) (rng() % 10 < 6 ? rng() % 6 : rng() % 256);
+    }
+    return input;
+}
+
+// First message of input given to stream_parser in random chunks, its length is stored in length
+template<typename T>
+scan_status parse_stream(const std::string &input, T *message, size_t *length) {
+    stream_parser<T> parser;
+    size_t appended = 0;
+    do {
+        auto chunk = std::min((size_t) rng() % 8 + 1, input.size() - appended);
+        parser.append(input.data() + appended, chunk);
+        appended += chunk;
+        auto status = parser.next(message);
+        if (status != scan_status::incomplete) {
+            *length = parser.last_frame().size();
+            return status;
+        }
+    } while (appended < input.size());
+    return scan_status::incomplete;
+}
+
+// Returns number of inputs decoded differently
+template<typename T>
+uint32_t check(const char *type_name) {
+    uint32_t complete = 0;
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < inputs_count; i++) {
+        auto input = random_input();
+        char *buffer = input.data();
+        size_t bytes_to_read = input.size();
+        auto parsed = parse<T>(&buffer, &bytes_to_read);
+        auto parse_status = parsed ? scan_status::complete
+                                   : bytes_to_read == 0 ? scan_status::incomplete : scan_status::invalid;
+
+        T streamed;
+        size_t streamed_length = 0;
+        auto stream_status = parse_stream(input, &streamed, &streamed_length);
+
+        std::string error;
+        if (parse_status != stream_status) {
+            error = "parse and stream_parser return different status";
+        } else if (parsed) {
+            complete++;
+            auto length = (size_t) (buffer - input.data());
+            auto encoded = encode(parsed.value());
+            char *encoded_buffer = encoded.data();
+            size_t encoded_bytes = encoded.size();
+            auto parsed_again = parse<T>(&encoded_buffer, &encoded_bytes);
+            if (streamed_length != length || encode(streamed) != encoded)
+                error = "parse and stream_parser decode different messages";
+            else if (!parsed_again || encoded_bytes != 0 || encoded_size(parsed_again.value()) != encoded.size())
+                error = "encoded message is decoded differently";
+        }
+        if (!error.empty()) {
+            mismatches++;
+            std::cerr << type_name << ": " << error << ", input:";
+            for (auto byte : input) {
+                std::cerr << " " << (int) (uint8_t) byte;
+            }
+            std::cerr << std::endl;
+        }
+    }
+    std::cout << type_name << ": inputs: " << inputs_count << ", complete messages: " << complete
+              << ", mismatches: " << mismatches << "\n";
+    return mismatches;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        p_opt::options_description description("Allowed options");
+        description.add_options()
+                ("help,h", "Wypisuje jak używać programu")
+                ("inputs,i", p_opt::value<uint32_t>(&inputs_count)->default_value(200000),
+                 "(opcjonalny) liczba losowych danych wejściowych dla każdego typu komunikatu")
+                ("seed,s", p_opt::value<uint32_t>(&seed)->default_value(7),
+                 "(opcjonalny) seed generatora danych wejściowych")
+                ("max-length,l", p_opt::value<uint16_t>(&max_length)->default_value(40),
+                 "(opcjonalny) maksymalna długość danych wejściowych w bajtach");
+
+        p_opt::variables_map var_map;
+        p_opt::store(p_opt::parse_command_line(argc, argv, description), var_map);
+
+        if (var_map.count("help")) {
+            std::cout << description << "\n";
+            return 0;
+        }
+
+        p_opt::notify(var_map);
+    }
+    catch (std::exception &e) {
+        std::cout << e.what() << '\n';
+        return 1;
+    }
+    rng.seed(seed);
+
+    uint32_t mismatches = 0;
+    mismatches += check<ServerMessage>("ServerMessage");
+    mismatches += check<ClientMessage>("ClientMessage");
+    mismatches += check<InputMessage>("InputMessage");
+    return mismatches == 0 ? 0 : 1;
+}
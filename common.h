@@ -2,6 +2,7 @@
 #define SIK_2022_COMMON_H
 
 #include <arpa/inet.h>
+#include <iostream>
 #include <optional>
 #include <vector>
 #include <cstdint>
@@ -11,6 +12,14 @@
 #include <cassert>
 #include <variant>
 #include <cstring>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <array>
+#include <string_view>
 
 /* = = = *
  * TYPES *
@@ -55,10 +64,11 @@ struct event_bomb_placed_t {
     Position position;
 };
 
+// pmr containers, so that server can build whole turn in one arena (see turn_arena in server.cpp)
 struct event_bomb_exploded_t {
     BombId id;
-    std::vector<PlayerId> robots_destroyed;
-    std::vector<Position> blocks_destroyed;
+    std::pmr::vector<PlayerId> robots_destroyed;
+    std::pmr::vector<Position> blocks_destroyed;
 };
 
 struct event_player_moved_t {
@@ -104,7 +114,7 @@ struct server_message_game_started_t {
 
 struct server_message_turn_t {
     uint16_t turn;
-    std::vector<Event> events;
+    std::pmr::vector<Event> events;
 };
 
 struct server_message_game_ended_t {
@@ -125,7 +135,7 @@ enum class InputMessageType {
 
 struct InputMessage {
     InputMessageType type;
-    Direction direction; // używane tylko dla typu InputMove
+    std::variant<std::monostate, Direction> variant; // Direction tylko dla typu Move
 };
 
 enum class DrawMessageType {
@@ -163,6 +173,182 @@ struct DrawMessage {
     std::variant<draw_message_lobby_t, draw_message_game_t> variant;
 };
 
+/* = = = = = = = = = = = *
+ * GAME STATE TABLES     *
+ * = = = = = = = = = = = */
+
+/* Stan graczy w układzie struktury tablic, indeksowany bezpośrednio identyfikatorem gracza
+ * (identyfikatory są małymi liczbami nadawanymi od 0). */
+struct player_table {
+    std::vector<PlayerId> ids; // present players in ascending order
+    std::vector<uint16_t> x;
+    std::vector<uint16_t> y;
+    std::vector<Score> scores;
+
+    void add(PlayerId id, Position position) {
+        if (contains(id))
+            return;
+        if (x.size() <= id) {
+            x.resize(id + 1);
+            y.resize(id + 1);
+            scores.resize(id + 1);
+            present_.resize(id + 1);
+        }
+        ids.insert(std::lower_bound(ids.begin(), ids.end(), id), id);
+        present_[id] = true;
+        x[id] = position.first;
+        y[id] = position.second;
+        scores[id] = 0;
+    }
+
+    bool contains(PlayerId id) const {
+        return id < present_.size() && present_[id];
+    }
+
+    Position position(PlayerId id) const {
+        return {x[id], y[id]};
+    }
+
+    void set_position(PlayerId id, Position position) {
+        x[id] = position.first;
+        y[id] = position.second;
+    }
+
+    std::unordered_map<PlayerId, Position> positions_map() const {
+        std::unordered_map<PlayerId, Position> result;
+        for (auto id : ids) {
+            result.insert({id, position(id)});
+        }
+        return result;
+    }
+
+    std::unordered_map<PlayerId, Score> scores_map() const {
+        std::unordered_map<PlayerId, Score> result;
+        for (auto id : ids) {
+            result.insert({id, scores[id]});
+        }
+        return result;
+    }
+
+    void clear() {
+        ids.clear();
+        x.clear();
+        y.clear();
+        scores.clear();
+        present_.clear();
+    }
+
+private:
+    std::vector<bool> present_;
+};
+
+/* Bomby w spakowanych tablicach (slot map). Usunięcie bomby przenosi na jej miejsce ostatnią bombę,
+ * a indeks identyfikator -> pozycja w tablicach jest kolejką, bo identyfikatory bomb rosną.
+ * Zamiast licznika przechowywana jest tura wybuchu, więc bomb nie trzeba zmieniać w każdej turze. */
+class bomb_table {
+public:
+    size_t size() const {
+        return ids_.size();
+    }
+
+    BombId id(size_t index) const {
+        return ids_[index];
+    }
+
+    Position position(size_t index) const {
+        return {x_[index], y_[index]};
+    }
+
+    uint32_t explosion_turn(size_t index) const {
+        return explosion_turns_[index];
+    }
+
+    // Turns left until explosion, as sent to the gui
+    uint16_t timer(size_t index, uint32_t current_turn) const {
+        return (uint16_t) (explosion_turns_[index] - current_turn);
+    }
+
+    // Index of bomb with given id or size() if there is no such bomb
+    size_t find(BombId id) const {
+        if (id < first_id_ || id - first_id_ >= slots_.size())
+            return size();
+        auto index = slots_[id - first_id_];
+        return index == NO_SLOT ? size() : index;
+    }
+
+    // Bomb with the same id is replaced
+    void add(BombId id, Position position, uint32_t explosion_turn) {
+        auto index = find(id);
+        if (index == size()) {
+            slot(id) = (uint32_t) ids_.size();
+            ids_.push_back(id);
+            x_.push_back(position.first);
+            y_.push_back(position.second);
+            explosion_turns_.push_back(explosion_turn);
+        } else {
+            x_[index] = position.first;
+            y_[index] = position.second;
+            explosion_turns_[index] = explosion_turn;
+        }
+    }
+
+    void erase(BombId id) {
+        auto index = find(id);
+        if (index == size())
+            return;
+        auto last = size() - 1;
+        if (index != last) {
+            ids_[index] = ids_[last];
+            x_[index] = x_[last];
+            y_[index] = y_[last];
+            explosion_turns_[index] = explosion_turns_[last];
+            slots_[ids_[index] - first_id_] = (uint32_t) index;
+        }
+        ids_.pop_back();
+        x_.pop_back();
+        y_.pop_back();
+        explosion_turns_.pop_back();
+        slots_[id - first_id_] = NO_SLOT;
+        while (!slots_.empty() && slots_.front() == NO_SLOT) { // oldest bombs exploded
+            slots_.pop_front();
+            first_id_++;
+        }
+        if (slots_.empty())
+            first_id_ = 0;
+    }
+
+    void clear() {
+        ids_.clear();
+        x_.clear();
+        y_.clear();
+        explosion_turns_.clear();
+        slots_.clear();
+        first_id_ = 0;
+    }
+
+private:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    uint32_t &slot(BombId id) {
+        if (slots_.empty())
+            first_id_ = id;
+        while (id < first_id_) {
+            slots_.push_front(NO_SLOT);
+            first_id_--;
+        }
+        if (id - first_id_ >= slots_.size())
+            slots_.resize(id - first_id_ + 1, NO_SLOT);
+        return slots_[id - first_id_];
+    }
+
+    std::vector<BombId> ids_;
+    std::vector<uint16_t> x_;
+    std::vector<uint16_t> y_;
+    std::vector<uint32_t> explosion_turns_;
+    std::deque<uint32_t> slots_; // index in arrays of bomb first_id_ + i
+    BombId first_id_ = 0;
+};
+
 /* = = = = = *
  * concepts  *
  * = = = = = */
@@ -211,744 +397,916 @@ concept MyEnum = requires(T t) {
              std::same_as<T, DrawMessageType>;
 };
 
-/* = = = *
- * PARSE *
- * = = = */
+template<typename T>
+concept Number = std::same_as<T, uint8_t> || std::same_as<T, uint16_t> || std::same_as<T, uint32_t>;
 
-/* * * * * * * * *
- * declarations  *
- * * * * * * * * */
+/* = = = = = = = = = *
+ * MESSAGE SCHEMA    *
+ * = = = = = = = = = */
 
-/* Parsuje obiekt typu T.
- * Jeżeli parsowanie zakończyło się niepowodzeniem i bytes_to_read = 0,
- * to jedynym powodem niepowodzenia była zbyt mała ilość danych */
-template<typename T>
-std::optional<T> parse(char **buffer, size_t *bytes_to_read) = delete;
+/* Jedyny opis układu komunikatów - z niego generowane są parse, serialize i encoded_size.
+ * Struktury są kodowane jako kolejne pola z listy, a komunikaty z typem (tagged) jako typ,
+ * po którym następuje wariant o indeksie równym wartości typu (std::monostate nie jest kodowany).
+ * Typy biblioteki standardowej i liczby są opisane przez swoje concepts. */
 
-/* standard library types */
+template<typename T>
+struct message_schema;
 
-template<Pair T>
-std::optional<T> parse(char **buffer, size_t *bytes_to_read);
+// Number of values of enum, bigger values are rejected by parse
+template<MyEnum T>
+constexpr uint8_t enum_values = 0;
 
-template<List T>
-std::optional<T> parse(char **buffer, size_t *bytes_to_read);
+template<auto... Fields>
+struct fields_schema {
+    static constexpr auto fields = std::make_tuple(Fields...);
+};
 
-template<Map T>
-std::optional<T> parse(char **buffer, size_t *bytes_to_read);
+template<auto Tag, auto Variant, typename... Payloads>
+struct tagged_schema {
+    static constexpr auto tag = Tag;
+    static constexpr auto variant = Variant;
+    using payloads = std::tuple<Payloads...>;
+};
 
-/* enums */
+template<> constexpr uint8_t enum_values<Direction> = 4;
+template<> constexpr uint8_t enum_values<ClientMessageType> = 4;
+template<> constexpr uint8_t enum_values<EventType> = 4;
+template<> constexpr uint8_t enum_values<ServerMessageType> = 5;
+template<> constexpr uint8_t enum_values<InputMessageType> = 3;
+template<> constexpr uint8_t enum_values<DrawMessageType> = 2;
 
 template<>
-std::optional<Direction> parse<Direction>(char **buffer, size_t *bytes_to_read);
+struct message_schema<ClientMessage>
+        : tagged_schema<&ClientMessage::type, &ClientMessage::variant,
+                        std::string, std::monostate, std::monostate, Direction> {};
 
 template<>
-std::optional<ClientMessageType> parse<ClientMessageType>(char **buffer, size_t *bytes_to_read);
+struct message_schema<event_bomb_placed_t>
+        : fields_schema<&event_bomb_placed_t::id, &event_bomb_placed_t::position> {};
 
 template<>
-std::optional<EventType> parse<EventType>(char **buffer, size_t *bytes_to_read);
+struct message_schema<event_bomb_exploded_t>
+        : fields_schema<&event_bomb_exploded_t::id, &event_bomb_exploded_t::robots_destroyed,
+                        &event_bomb_exploded_t::blocks_destroyed> {};
 
 template<>
-std::optional<ServerMessageType> parse<ServerMessageType>(char **buffer, size_t *bytes_to_read);
+struct message_schema<event_player_moved_t>
+        : fields_schema<&event_player_moved_t::id, &event_player_moved_t::position> {};
 
 template<>
-std::optional<InputMessageType> parse<InputMessageType>(char **buffer, size_t *bytes_to_read);
+struct message_schema<event_block_placed_t>
+        : fields_schema<&event_block_placed_t::position> {};
 
-/* my types */
+template<>
+struct message_schema<Event>
+        : tagged_schema<&Event::type, &Event::variant,
+                        event_bomb_placed_t, event_bomb_exploded_t, event_player_moved_t, event_block_placed_t> {};
 
 template<>
-std::optional<Event> parse<Event>(char **buffer, size_t *bytes_to_read);
+struct message_schema<server_message_hello_t>
+        : fields_schema<&server_message_hello_t::server_name, &server_message_hello_t::players_count,
+                        &server_message_hello_t::size_x, &server_message_hello_t::size_y,
+                        &server_message_hello_t::game_length, &server_message_hello_t::explosion_radius,
+                        &server_message_hello_t::bomb_timer> {};
 
 template<>
-std::optional<ServerMessage> parse<ServerMessage>(char **buffer, size_t *bytes_to_read);
+struct message_schema<server_message_accepted_player_t>
+        : fields_schema<&server_message_accepted_player_t::id, &server_message_accepted_player_t::player> {};
 
 template<>
-std::optional<InputMessage> parse<InputMessage>(char **buffer, size_t *bytes_to_read);
+struct message_schema<server_message_game_started_t>
+        : fields_schema<&server_message_game_started_t::players> {};
 
 template<>
-std::optional<ClientMessage> parse<ClientMessage>(char **buffer, size_t *bytes_to_read);
+struct message_schema<server_message_turn_t>
+        : fields_schema<&server_message_turn_t::turn, &server_message_turn_t::events> {};
 
-/* * * * * * * * * *
- * primitive types *
- * * * * * * * * * */
+template<>
+struct message_schema<server_message_game_ended_t>
+        : fields_schema<&server_message_game_ended_t::scores> {};
 
 template<>
-std::optional<uint8_t> parse<uint8_t>(char **buffer, size_t *bytes_to_read) {
-    if (*bytes_to_read < 1)
-        return {};
-    auto result = *(uint8_t *) *buffer;
-    *buffer += 1;
-    *bytes_to_read -= 1;
+struct message_schema<ServerMessage>
+        : tagged_schema<&ServerMessage::type, &ServerMessage::variant,
+                        server_message_hello_t, server_message_accepted_player_t, server_message_game_started_t,
+                        server_message_turn_t, server_message_game_ended_t> {};
 
-    return result;
-}
+template<>
+struct message_schema<InputMessage>
+        : tagged_schema<&InputMessage::type, &InputMessage::variant,
+                        std::monostate, std::monostate, Direction> {};
 
 template<>
-std::optional<uint16_t> parse<uint16_t>(char **buffer, size_t *bytes_to_read) {
-    if (*bytes_to_read < 2) {
-        *bytes_to_read = 0;
-        return {};
-    }
-    auto result = *(uint16_t *) *buffer;
-    *buffer += 2;
-    *bytes_to_read -= 2;
+struct message_schema<draw_message_lobby_t>
+        : fields_schema<&draw_message_lobby_t::server_name, &draw_message_lobby_t::players_count,
+                        &draw_message_lobby_t::size_x, &draw_message_lobby_t::size_y,
+                        &draw_message_lobby_t::game_length, &draw_message_lobby_t::explosion_radius,
+                        &draw_message_lobby_t::bomb_timer, &draw_message_lobby_t::players> {};
 
-    return ntohs(result);
-}
+template<>
+struct message_schema<draw_message_game_t>
+        : fields_schema<&draw_message_game_t::server_name, &draw_message_game_t::size_x,
+                        &draw_message_game_t::size_y, &draw_message_game_t::game_length, &draw_message_game_t::turn,
+                        &draw_message_game_t::players, &draw_message_game_t::player_positions,
+                        &draw_message_game_t::blocks, &draw_message_game_t::bombs, &draw_message_game_t::explosions,
+                        &draw_message_game_t::scores> {};
 
 template<>
-std::optional<uint32_t> parse<uint32_t>(char **buffer, size_t *bytes_to_read) {
-    if (*bytes_to_read < 4) {
-        *bytes_to_read = 0;
-        return {};
-    }
-    auto result = *(uint32_t *) *buffer;
-    *buffer += 4;
-    *bytes_to_read -= 4;
+struct message_schema<DrawMessage>
+        : tagged_schema<&DrawMessage::type, &DrawMessage::variant, draw_message_lobby_t, draw_message_game_t> {};
 
-    return ntohl(result);
-}
+template<typename T>
+concept Struct = requires { message_schema<T>::fields; };
 
-/* * * * * * * * * * * * * *
- * standard library types  *
- * * * * * * * * * * * * * */
+template<typename T>
+concept Tagged = requires { message_schema<T>::tag; };
 
-template<>
-std::optional<std::string> parse(char **buffer, size_t *bytes_to_read) {
-    auto size = parse<uint8_t>(buffer, bytes_to_read);
-    if (!size)
-        return {};
-    auto size_value = size.value();
-    if (*bytes_to_read < size_value) {
-        *bytes_to_read = 0;
-        return {}; // not enough bytes left
-    }
-    std::string result(*buffer, size_value);
-    *buffer += size_value;
-    *bytes_to_read -= size_value;
+/* = = = = = *
+ * CODEC     *
+ * = = = = = */
 
-    return result;
+/* codec<T> jest generowany z opisu typu:
+ *  - fixed_size - rozmiar zakodowanej wartości, jeżeli nie zależy od wartości (0 w przeciwnym przypadku),
+ *  - size(value) - rozmiar zakodowanej wartości,
+ *  - encode(value, buffer) - zapis bez sprawdzania miejsca (serialize sprawdza je raz dla całej wartości),
+ *  - valid(buffer) - dla typów o stałym rozmiarze, czy zakodowane wartości typów wyliczeniowych są poprawne,
+ *  - decode_unchecked(value, buffer) - odczyt bez żadnego sprawdzania, dane muszą być wcześniej
+ *    sprawdzone przez message_scanner. */
+
+template<typename T>
+struct codec;
+
+template<typename T>
+size_t encoded_size(const T &value) {
+    if constexpr (codec<T>::fixed_size > 0)
+        return codec<T>::fixed_size;
+    else
+        return codec<T>::size(value);
 }
 
+template<typename M>
+struct member_traits;
 
-template<List T>
-std::optional<T> parse(char **buffer, size_t *bytes_to_read) {
-    auto size = parse<uint32_t>(buffer, bytes_to_read);
-    if (!size)
-        return {};
-    auto size_value = size.value();
-    T result;
-    for (uint32_t i = 0; i < size_value; i++) {
-        auto to_push_option = parse<typename T::value_type>(buffer, bytes_to_read);
-        if (!to_push_option)
-            return {};
-        result.push_back(to_push_option.value());
+template<typename C, typename M>
+struct member_traits<M C::*> {
+    typedef M type;
+};
+
+// Type of field pointed to by member pointer of type M
+template<typename M>
+using field_type = typename member_traits<M>::type;
+
+/* primitive types */
+
+template<Number T>
+struct codec<T> {
+    static constexpr size_t fixed_size = sizeof(T);
+    static constexpr bool needs_validation = false;
+
+    static void encode(const T &value, char **buffer) {
+        T network_order;
+        if constexpr (sizeof(T) == 4)
+            network_order = htonl(value);
+        else if constexpr (sizeof(T) == 2)
+            network_order = htons(value);
+        else
+            network_order = value;
+        memcpy(*buffer, &network_order, sizeof(T));
+        *buffer += sizeof(T);
     }
-    return result;
-}
 
-template<Map T>
-std::optional<T> parse(char **buffer, size_t *bytes_to_read) {
-    auto size = parse<uint32_t>(buffer, bytes_to_read);
-    if (!size)
-        return {};
-    auto size_value = size.value();
-    T result;
-    for (uint32_t i = 0; i < size_value; i++) {
-        auto key_option = parse<typename T::key_type>(buffer, bytes_to_read);
-        if (!key_option)
-            return {};
-        auto value_option = parse<typename T::mapped_type>(buffer, bytes_to_read);
-        if (!value_option)
-            return {};
-        result.insert({key_option.value(), value_option.value()});
+    static bool valid(const char *) {
+        return true;
     }
-    return result;
-}
 
+    static void decode_unchecked(T *value, char **buffer) {
+        T network_order;
+        memcpy(&network_order, *buffer, sizeof(T));
+        *buffer += sizeof(T);
+        if constexpr (sizeof(T) == 4)
+            *value = ntohl(network_order);
+        else if constexpr (sizeof(T) == 2)
+            *value = ntohs(network_order);
+        else
+            *value = network_order;
+    }
+};
 
-template<Pair T>
-std::optional<T> parse(char **buffer, size_t *bytes_to_read) {
-    auto first = parse<typename T::first_type>(buffer, bytes_to_read);
-    auto second = parse<typename T::second_type>(buffer, bytes_to_read);
-    if (first && second) {
-        T result;
-        result.first = first.value();
-        result.second = second.value();
-        return result;
+template<MyEnum T>
+struct codec<T> {
+    static constexpr size_t fixed_size = 1;
+    static constexpr bool needs_validation = true;
+
+    static void encode(const T &value, char **buffer) {
+        codec<uint8_t>::encode(static_cast<uint8_t>(value), buffer);
     }
-    return {};
-}
 
-/* * * * * * *
- * My types  *
- * * * * * * */
+    static bool valid(const char *buffer) {
+        return (uint8_t) *buffer < enum_values<T>;
+    }
+
+    static void decode_unchecked(T *value, char **buffer) {
+        *value = T((uint8_t) **buffer);
+        *buffer += 1;
+    }
+};
 
-/* Enums */
+/* standard library types */
 
+// Strings are prefixed with one byte length, longer strings are truncated
 template<>
-std::optional<Direction> parse<Direction>(char **buffer, size_t *bytes_to_read) {
-    auto result = parse<uint8_t>(buffer, bytes_to_read);
-    if (!result.has_value())
-        return {};
-    else if (result.value() > 4) {
-        *bytes_to_read = std::max(*bytes_to_read, (size_t) 1);
-        return {};
+struct codec<std::string> {
+    static constexpr size_t fixed_size = 0;
+
+    static size_t size(const std::string &value) {
+        return 1 + (uint8_t) value.size();
     }
-    return Direction(result.value());
-}
 
-template<>
-std::optional<ClientMessageType> parse<ClientMessageType>(char **buffer, size_t *bytes_to_read) {
-    auto result = parse<uint8_t>(buffer, bytes_to_read);
-    if (!result.has_value())
-        return {};
-    else if (result.value() > 4) {
-        *bytes_to_read = std::max(*bytes_to_read, (size_t) 1);
-        return {};
+    static void encode(const std::string &value, char **buffer) {
+        auto size = (uint8_t) value.size();
+        codec<uint8_t>::encode(size, buffer);
+        memcpy(*buffer, value.data(), size);
+        *buffer += size;
     }
-    return ClientMessageType(result.value());
-}
 
-template<>
-std::optional<EventType> parse<EventType>(char **buffer, size_t *bytes_to_read) {
-    auto result = parse<uint8_t>(buffer, bytes_to_read);
-    if (!result.has_value())
-        return {};
-    else if (result.value() > 4) {
-        *bytes_to_read = std::max(*bytes_to_read, (size_t) 1);
-        return {};
+    static void decode_unchecked(std::string *value, char **buffer) {
+        auto size = (uint8_t) **buffer;
+        value->assign(*buffer + 1, size);
+        *buffer += 1 + size;
     }
-    return EventType(result.value());
-}
+};
 
-template<>
-std::optional<ServerMessageType> parse<ServerMessageType>(char **buffer, size_t *bytes_to_read) {
-    auto result = parse<uint8_t>(buffer, bytes_to_read);
-    if (!result.has_value())
-        return {};
-    else if (result.value() > 5) {
-        *bytes_to_read = std::max(*bytes_to_read, (size_t) 1);
-        return {};
+template<Pair T>
+struct codec<T> {
+    typedef typename T::first_type first_type;
+    typedef typename T::second_type second_type;
+
+    static constexpr size_t fixed_size = codec<first_type>::fixed_size > 0 && codec<second_type>::fixed_size > 0
+            ? codec<first_type>::fixed_size + codec<second_type>::fixed_size : 0;
+    static constexpr bool needs_validation = fixed_size > 0
+            && (codec<first_type>::needs_validation || codec<second_type>::needs_validation);
+
+    static size_t size(const T &value) {
+        return encoded_size(value.first) + encoded_size(value.second);
     }
-    return ServerMessageType(result.value());
-}
 
-template<>
-std::optional<InputMessageType> parse<InputMessageType>(char **buffer, size_t *bytes_to_read) {
-    auto result = parse<uint8_t>(buffer, bytes_to_read);
-    if (!result.has_value())
-        return {};
-    else if (result.value() > 3) {
-        *bytes_to_read = std::max(*bytes_to_read, (size_t) 1);
-        return {};
+    static void encode(const T &value, char **buffer) {
+        codec<first_type>::encode(value.first, buffer);
+        codec<second_type>::encode(value.second, buffer);
     }
-    return InputMessageType(result.value());
-}
 
-/* Structs */
+    static bool valid(const char *buffer) {
+        return codec<first_type>::valid(buffer) && codec<second_type>::valid(buffer + codec<first_type>::fixed_size);
+    }
 
-template<>
-std::optional<Event> parse<Event>(char **buffer, size_t *bytes_to_read) {
-    auto type_option = parse<EventType>(buffer, bytes_to_read);
-    if (!type_option)
-        return {};
-    auto type = type_option.value();
-    Event result;
-    result.type = type;
-    switch (type) {
-        case EventType::BombPlaced: {
-            auto bomb_id = parse<BombId>(buffer, bytes_to_read);
-            auto position = parse<Position>(buffer, bytes_to_read);
-            if (!bomb_id || !position)
-                return {};
-            result.variant = event_bomb_placed_t({bomb_id.value(), position.value()});
-            break;
+    static void decode_unchecked(T *value, char **buffer) {
+        codec<first_type>::decode_unchecked(&value->first, buffer);
+        codec<second_type>::decode_unchecked(&value->second, buffer);
+    }
+};
+
+// Lists are prefixed with four byte number of elements
+template<List T>
+struct codec<T> {
+    typedef typename T::value_type element_type;
+
+    static constexpr size_t fixed_size = 0;
+
+    static size_t size(const T &value) {
+        if constexpr (codec<element_type>::fixed_size > 0) {
+            return 4 + value.size() * codec<element_type>::fixed_size;
+        } else {
+            size_t result = 4;
+            for (const auto &element : value) {
+                result += encoded_size((const element_type &) element);
+            }
+            return result;
         }
+    }
 
-        case EventType::BombExploded: {
-            auto bomb_id = parse<BombId>(buffer, bytes_to_read);
-            auto robots_destroyed = parse<std::vector<PlayerId>>(buffer, bytes_to_read);
-            auto blocks_destroyed = parse<std::vector<Position>>(buffer, bytes_to_read);
-            if (!bomb_id || !robots_destroyed || !blocks_destroyed)
-                return {};
-            result.variant = event_bomb_exploded_t({
-                                                           bomb_id.value(),
-                                                           robots_destroyed.value(),
-                                                           blocks_destroyed.value()
-                                                   });
-            break;
+    static void encode(const T &value, char **buffer) {
+        codec<uint32_t>::encode((uint32_t) value.size(), buffer);
+        for (const auto &element : value) {
+            codec<element_type>::encode((const element_type &) element, buffer);
         }
+    }
 
-        case EventType::PlayerMoved: {
-            auto player_id = parse<PlayerId>(buffer, bytes_to_read);
-            auto position = parse<Position>(buffer, bytes_to_read);
-            if (!player_id || !position)
-                return {};
-            result.variant = event_player_moved_t({player_id.value(), position.value()});
-            break;
+    static void decode_unchecked(T *value, char **buffer) {
+        uint32_t size;
+        codec<uint32_t>::decode_unchecked(&size, buffer);
+        value->reserve(value->size() + size); // the scan has checked that all elements are present
+        for (uint32_t i = 0; i < size; i++) {
+            codec<element_type>::decode_unchecked(&value->emplace_back(), buffer);
         }
+    }
+};
 
-        case EventType::BlockPlaced: {
-            auto position = parse<Position>(buffer, bytes_to_read);
-            if (!position)
-                return {};
-            result.variant = event_block_placed_t({position.value()});
-            break;
+// Maps are prefixed with four byte number of elements, each element is key followed by value
+template<Map T>
+struct codec<T> {
+    typedef typename T::key_type key_type;
+    typedef typename T::mapped_type mapped_type;
+
+    static constexpr size_t fixed_size = 0;
+
+    static size_t size(const T &value) {
+        if constexpr (codec<key_type>::fixed_size > 0 && codec<mapped_type>::fixed_size > 0) {
+            return 4 + value.size() * (codec<key_type>::fixed_size + codec<mapped_type>::fixed_size);
+        } else {
+            size_t result = 4;
+            for (const auto &element : value) {
+                result += encoded_size(element.first) + encoded_size(element.second);
+            }
+            return result;
         }
+    }
 
-            assert(false);
+    static void encode(const T &value, char **buffer) {
+        codec<uint32_t>::encode((uint32_t) value.size(), buffer);
+        for (const auto &element : value) {
+            codec<key_type>::encode(element.first, buffer);
+            codec<mapped_type>::encode(element.second, buffer);
+        }
     }
-    return result;
-}
 
-template<>
-std::optional<server_message_hello_t> parse<server_message_hello_t>(char **buffer, size_t *bytes_to_read) {
-    auto server_name = parse<std::string>(buffer, bytes_to_read);
-    auto player_count = parse<uint8_t>(buffer, bytes_to_read);
-    auto size_x = parse<uint16_t>(buffer, bytes_to_read);
-    auto size_y = parse<uint16_t>(buffer, bytes_to_read);
-    auto game_length = parse<uint16_t>(buffer, bytes_to_read);
-    auto explosion_radius = parse<uint16_t>(buffer, bytes_to_read);
-    auto bomb_timer = parse<uint16_t>(buffer, bytes_to_read);
-    if (!server_name || !player_count || !size_x || !size_y || !game_length || !explosion_radius || !bomb_timer)
-        return {};
-    return server_message_hello_t({server_name.value(), player_count.value(), size_x.value(), size_y.value(),
-                                   game_length.value(), explosion_radius.value(), bomb_timer.value()});
-}
+    static void decode_unchecked(T *value, char **buffer) {
+        uint32_t size;
+        codec<uint32_t>::decode_unchecked(&size, buffer);
+        for (uint32_t i = 0; i < size; i++) {
+            key_type key{};
+            mapped_type mapped{};
+            codec<key_type>::decode_unchecked(&key, buffer);
+            codec<mapped_type>::decode_unchecked(&mapped, buffer);
+            value->insert({std::move(key), std::move(mapped)}); // first of repeated keys is kept
+        }
+    }
+};
 
-template<>
-std::optional<server_message_accepted_player_t>
-parse<server_message_accepted_player_t>(char **buffer, size_t *bytes_to_read) {
-    auto id = parse<PlayerId>(buffer, bytes_to_read);
-    auto player = parse<Player>(buffer, bytes_to_read);
-    if (!id || !player)
-        return {};
-    return server_message_accepted_player_t({id.value(), player.value()});
-}
+/* my types */
 
-template<>
-std::optional<server_message_game_started_t>
-parse<server_message_game_started_t>(char **buffer, size_t *bytes_to_read) {
-    auto players = parse<std::unordered_map<PlayerId, Player>>(buffer, bytes_to_read);
-    if (!players)
-        return {};
-    return server_message_game_started_t({players.value()});
-}
+template<Struct T>
+struct codec<T> {
+    static constexpr auto fields = message_schema<T>::fields;
 
-template<>
-std::optional<server_message_turn_t> parse<server_message_turn_t>(char **buffer, size_t *bytes_to_read) {
-    auto turn = parse<uint16_t>(buffer, bytes_to_read);
-    auto events = parse<std::vector<Event>>(buffer, bytes_to_read);
-    if (!turn || !events)
-        return {};
-    return server_message_turn_t({turn.value(), events.value()});
-}
+    static constexpr size_t fixed_size = std::apply([](auto... field) {
+        bool all_fixed = ((codec<field_type<decltype(field)>>::fixed_size > 0) && ...);
+        return all_fixed ? (codec<field_type<decltype(field)>>::fixed_size + ...) : 0;
+    }, fields);
+    static constexpr bool needs_validation = fixed_size > 0 && std::apply([](auto... field) {
+        return (codec<field_type<decltype(field)>>::needs_validation || ...);
+    }, fields);
 
-template<>
-std::optional<server_message_game_ended_t> parse<server_message_game_ended_t>(char **buffer, size_t *bytes_to_read) {
-    auto scores = parse<std::unordered_map<PlayerId, Score>>(buffer, bytes_to_read);
-    if (!scores)
-        return {};
-    return server_message_game_ended_t({scores.value()});
-}
+    static size_t size(const T &value) {
+        return std::apply([&](auto... field) { return (encoded_size(value.*field) + ...); }, fields);
+    }
 
-template<>
-std::optional<ServerMessage> parse<ServerMessage>(char **buffer, size_t *bytes_to_read) {
-    auto type = parse<ServerMessageType>(buffer, bytes_to_read);
-    if (!type)
-        return {};
-    ServerMessage result;
-    result.type = type.value();
-
-    switch (type.value()) {
-        case ServerMessageType::Hello: {
-            auto hello = parse<server_message_hello_t>(buffer, bytes_to_read);
-            if (!hello)
-                return {};
-            result.variant = hello.value();
-            break;
-        }
+    static void encode(const T &value, char **buffer) {
+        std::apply([&](auto... field) {
+            (codec<std::remove_cvref_t<decltype(value.*field)>>::encode(value.*field, buffer), ...);
+        }, fields);
+    }
 
-        case ServerMessageType::AcceptedPlayer: {
-            auto accepted_player = parse<server_message_accepted_player_t>(buffer, bytes_to_read);
-            if (!accepted_player)
-                return {};
-            result.variant = accepted_player.value();
-            break;
-        }
+    static bool valid(const char *buffer) {
+        return std::apply([&](auto... field) {
+            return ((codec<std::remove_cvref_t<decltype(std::declval<T>().*field)>>::valid(buffer)
+                     && (buffer += codec<std::remove_cvref_t<decltype(std::declval<T>().*field)>>::fixed_size, true))
+                    && ...);
+        }, fields);
+    }
 
-        case ServerMessageType::GameStarted: {
-            auto game_started = parse<server_message_game_started_t>(buffer, bytes_to_read);
-            if (!game_started)
-                return {};
-            result.variant = game_started.value();
-            break;
-        }
+    static void decode_unchecked(T *value, char **buffer) {
+        std::apply([&](auto... field) {
+            (codec<std::remove_cvref_t<decltype(value->*field)>>::decode_unchecked(&(value->*field), buffer), ...);
+        }, fields);
+    }
+};
 
-        case ServerMessageType::Turn: {
-            auto turn = parse<server_message_turn_t>(buffer, bytes_to_read);
-            if (!turn)
-                return {};
-            result.variant = turn.value();
-            break;
-        }
+template<Tagged T>
+struct codec<T> {
+    typedef std::remove_cvref_t<decltype(std::declval<T>().*message_schema<T>::tag)> tag_type;
+    typedef typename message_schema<T>::payloads payloads;
+    static constexpr size_t payloads_count = std::tuple_size_v<payloads>;
+    static_assert(enum_values<tag_type> == payloads_count, "every message type needs a payload");
 
-        case ServerMessageType::GameEnded: {
-            auto game_ended = parse<server_message_game_ended_t>(buffer, bytes_to_read);
-            if (!game_ended)
-                return {};
-            result.variant = game_ended.value();
-            break;
-        }
+    template<size_t I>
+    using payload_type = std::tuple_element_t<I, payloads>;
+
+    static constexpr size_t fixed_size = 0;
 
-            assert(false);
+    // Calls action with std::integral_constant holding index of payload selected by tag
+    template<typename Action>
+    static auto visit(tag_type tag, Action &&action) {
+        return visit_from<0>((size_t) tag, action);
     }
 
-    return result;
-}
+    static size_t size(const T &value) {
+        return 1 + visit(value.*message_schema<T>::tag, [&](auto index) -> size_t {
+            using payload = payload_type<decltype(index)::value>;
+            if constexpr (std::is_same_v<payload, std::monostate>)
+                return 0;
+            else
+                return encoded_size(std::get<payload>(value.*message_schema<T>::variant));
+        });
+    }
 
-template<>
-std::optional<InputMessage> parse<InputMessage>(char **buffer, size_t *bytes_to_read) {
-    auto type = parse<InputMessageType>(buffer, bytes_to_read);
-    if (!type)
-        return {};
-    InputMessage result;
-    result.type = type.value();
-    if (type.value() == InputMessageType::Move) {
-        auto direction = parse<Direction>(buffer, bytes_to_read);
-        if (!direction)
-            return {};
-        result.direction = direction.value();
-    } else {
-        result.direction = Direction(0); // nie będzie używane, inicjalizacja czymkolwiek
+    static void encode(const T &value, char **buffer) {
+        codec<tag_type>::encode(value.*message_schema<T>::tag, buffer);
+        visit(value.*message_schema<T>::tag, [&](auto index) {
+            using payload = payload_type<decltype(index)::value>;
+            if constexpr (!std::is_same_v<payload, std::monostate>)
+                codec<payload>::encode(std::get<payload>(value.*message_schema<T>::variant), buffer);
+        });
     }
-    return result;
-}
 
-template<>
-std::optional<ClientMessage> parse<ClientMessage>(char **buffer, size_t *bytes_to_read) {
-    auto type = parse<ClientMessageType>(buffer, bytes_to_read);
-    if (!type)
-        return {};
-    ClientMessage result;
-    result.type = type.value();
-    if (type.value() == ClientMessageType::Join) {
-        auto name = parse<std::string>(buffer, bytes_to_read);
-        if (!name)
-            return {};
-        result.variant = name.value();
-    } else if (type.value() == ClientMessageType::Move) {
-        auto direction = parse<Direction>(buffer, bytes_to_read);
-        if (!direction)
-            return {};
-        result.variant = direction.value();
+    static void decode_unchecked(T *value, char **buffer) {
+        auto &tag = value->*message_schema<T>::tag;
+        codec<tag_type>::decode_unchecked(&tag, buffer);
+        visit(tag, [&](auto index) {
+            using payload = payload_type<decltype(index)::value>;
+            auto &variant = value->*message_schema<T>::variant;
+            variant.template emplace<payload>();
+            if constexpr (!std::is_same_v<payload, std::monostate>)
+                codec<payload>::decode_unchecked(&std::get<payload>(variant), buffer);
+        });
+    }
+
+private:
+    template<size_t I, typename Action>
+    static auto visit_from(size_t tag, Action &action) {
+        if constexpr (I + 1 == payloads_count) {
+            return action(std::integral_constant<size_t, I>());
+        } else {
+            if (tag == I)
+                return action(std::integral_constant<size_t, I>());
+            return visit_from<I + 1>(tag, action);
+        }
+    }
+};
+
+/* Wywołuje append na kolejnych częściach zakodowanej wartości (polach, elementach list),
+ * używane do rozłożenia dużej wartości na wiele segmentów. */
+template<typename T>
+constexpr bool has_parts = List<T> || Map<T> || Struct<T> || Tagged<T>;
+
+template<typename T, typename Append>
+bool append_parts(const T &value, Append &&append) {
+    if constexpr (List<T>) {
+        if (!append((uint32_t) value.size()))
+            return false;
+        for (const auto &element : value) {
+            if (!append((const typename T::value_type &) element))
+                return false;
+        }
+        return true;
+    } else if constexpr (Map<T>) {
+        if (!append((uint32_t) value.size()))
+            return false;
+        for (const auto &element : value) {
+            if (!append(element.first) || !append(element.second))
+                return false;
+        }
+        return true;
+    } else if constexpr (Struct<T>) {
+        return std::apply([&](auto... field) { return (append(value.*field) && ...); }, message_schema<T>::fields);
     } else {
-        result.variant = std::monostate();
+        static_assert(Tagged<T>);
+        if (!append(value.*message_schema<T>::tag))
+            return false;
+        return codec<T>::visit(value.*message_schema<T>::tag, [&](auto index) {
+            using payload = typename codec<T>::template payload_type<decltype(index)::value>;
+            if constexpr (std::is_same_v<payload, std::monostate>)
+                return true;
+            else
+                return append(std::get<payload>(value.*message_schema<T>::variant));
+        });
     }
-    return result;
 }
 
-/* = = = = = *
- * SERIALIZE *
- * = = = = = */
+/* = = = = = = = = = = = = = = = *
+ * SCANNING RECEIVED MESSAGES    *
+ * = = = = = = = = = = = = = = = */
 
-/* * * * * * * * *
- * declarations  *
- * * * * * * * * */
+#define MAX_SCAN_DEPTH 16
 
+/* Pierwsza faza parsowania - sprawdza, czy na początku danych jest cały poprawny komunikat,
+ * i wyznacza jego długość, nie tworząc żadnych obiektów. Stan skanowania (stos skanowanych wartości)
+ * jest pamiętany między wywołaniami scan, więc gdy komunikat nie doszedł jeszcze w całości,
+ * po dopisaniu danych skanowanie jest kontynuowane od miejsca, w którym się zatrzymało.
+ * Druga faza (codec::decode_unchecked) odczytuje sprawdzony komunikat bez żadnych sprawdzeń. */
+
+// Elements of maps are encoded as pairs
 template<typename T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write) = delete;
+struct encoded_element {
+    typedef typename T::value_type type;
+};
 
-template<Pair T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write);
+template<Map T>
+struct encoded_element<T> {
+    typedef std::pair<typename T::key_type, typename T::mapped_type> type;
+};
 
-template<List T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write);
+enum class scan_status {
+    complete,
+    incomplete, // more data is needed
+    invalid
+};
 
-template<Map T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write);
+class message_scanner {
+public:
+    template<typename T>
+    void start() {
+        depth_ = 0;
+        scanned_ = 0;
+        push(&step<T>);
+    }
 
-template<>
-bool serialize(Direction to_serialize, char **buffer, size_t *bytes_to_write);
+    // Data has to begin with the data given in earlier calls since start()
+    scan_status scan(const char *data, size_t size) {
+        data_ = data;
+        size_ = size;
+        while (depth_ > 0) {
+            auto status = stack_[depth_ - 1].step(*this);
+            if (status != scan_status::complete)
+                return status;
+        }
+        return scan_status::complete;
+    }
 
-template<MyEnum T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write);
+    // After complete scan, length of the message
+    size_t scanned() const {
+        return scanned_;
+    }
 
-template<>
-bool serialize(ClientMessage to_serialize, char **buffer, size_t *bytes_to_write);
+private:
+    typedef scan_status (*step_function)(message_scanner &);
 
-template<>
-bool serialize(DrawMessage to_serialize, char **buffer, size_t *bytes_to_write);
+    struct frame {
+        step_function step;
+        uint32_t remaining; // elements of list or fields of struct left to scan
+        bool started; // number of elements of list has been read
+    };
 
-template<>
-bool serialize(Event to_serialize, char **buffer, size_t *bytes_to_write);
+    void push(step_function step_to_push) {
+        assert(depth_ < MAX_SCAN_DEPTH);
+        stack_[depth_++] = {step_to_push, 0, false};
+    }
 
-/* * * * * * * * * *
- * primitive types *
- * * * * * * * * * */
+    // Marks value being scanned by the top frame as scanned
+    scan_status pop() {
+        depth_--;
+        return scan_status::complete;
+    }
 
-template<>
-bool serialize(uint8_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    if (*bytes_to_write < 1)
-        return false;
-    *(uint8_t *) (*buffer) = to_serialize;
-    *buffer += 1;
-    *bytes_to_write -= 1;
-    return true;
-}
+    size_t available() const {
+        return size_ - scanned_;
+    }
 
-template<>
-bool serialize(uint16_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    if (*bytes_to_write < 2)
-        return false;
-    *(uint16_t *) (*buffer) = htons(to_serialize);
-    *buffer += 2;
-    *bytes_to_write -= 2;
-    return true;
-}
+    const char *position() const {
+        return data_ + scanned_;
+    }
 
-template<>
-bool serialize(uint32_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    if (*bytes_to_write < 4)
-        return false;
-    *(uint32_t *) (*buffer) = htonl(to_serialize);
-    *buffer += 4;
-    *bytes_to_write -= 4;
-    return true;
-}
+    uint32_t read_size() {
+        uint32_t size;
+        char *buffer = const_cast<char *>(position());
+        codec<uint32_t>::decode_unchecked(&size, &buffer);
+        scanned_ += 4;
+        return size;
+    }
 
-/* * * * * * * * * * * * * *
- * standard library types  *
- * * * * * * * * * * * * * */
+    // Scans fixed size values, as many as there are available
+    template<typename T>
+    scan_status skip_fixed(uint32_t *count) {
+        constexpr size_t size = codec<T>::fixed_size;
+        auto to_skip = std::min((size_t) *count, available() / size);
+        if constexpr (codec<T>::needs_validation) {
+            for (size_t i = 0; i < to_skip; i++) {
+                if (!codec<T>::valid(position() + i * size))
+                    return scan_status::invalid;
+            }
+        }
+        scanned_ += to_skip * size;
+        *count -= (uint32_t) to_skip;
+        return *count == 0 ? scan_status::complete : scan_status::incomplete;
+    }
 
-template<>
-bool serialize(std::string to_serialize, char **buffer, size_t *bytes_to_write) {
-    auto size = (uint8_t) to_serialize.size();
-    auto success = serialize(size, buffer, bytes_to_write);
-    if (!success || *bytes_to_write < size)
-        return false;
-    memcpy(*buffer, to_serialize.c_str(), size);
-    *buffer += size;
-    *bytes_to_write -= size;
-    return true;
-}
+    // Scans a bit of value of type T, returns complete if it made progress
+    template<typename T>
+    static scan_status step(message_scanner &scanner) {
+        auto &top = scanner.stack_[scanner.depth_ - 1];
+        if constexpr (codec<T>::fixed_size > 0) {
+            uint32_t count = 1;
+            auto status = scanner.skip_fixed<T>(&count);
+            return status == scan_status::complete ? scanner.pop() : status;
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            if (scanner.available() < 1 || scanner.available() < 1 + (size_t) (uint8_t) *scanner.position())
+                return scan_status::incomplete;
+            scanner.scanned_ += 1 + (uint8_t) *scanner.position();
+            return scanner.pop();
+        } else if constexpr (List<T> || Map<T>) {
+            typedef typename encoded_element<T>::type element_type;
+            if (!top.started) {
+                if (scanner.available() < 4)
+                    return scan_status::incomplete;
+                top.remaining = scanner.read_size();
+                top.started = true;
+            }
+            if constexpr (codec<element_type>::fixed_size > 0) {
+                auto status = scanner.skip_fixed<element_type>(&top.remaining);
+                return status == scan_status::complete ? scanner.pop() : status;
+            } else {
+                if (top.remaining == 0)
+                    return scanner.pop();
+                top.remaining--;
+                scanner.push(&step<element_type>);
+                return scan_status::complete;
+            }
+        } else if constexpr (Pair<T> || Struct<T>) {
+            static constexpr auto field_steps = field_step_functions<T>();
+            if (top.remaining == field_steps.size())
+                return scanner.pop();
+            scanner.push(field_steps[top.remaining++]);
+            return scan_status::complete;
+        } else {
+            static_assert(Tagged<T>);
+            typedef typename codec<T>::tag_type tag_type;
+            if (scanner.available() < 1)
+                return scan_status::incomplete;
+            if (!codec<tag_type>::valid(scanner.position()))
+                return scan_status::invalid;
+            auto tag = (uint8_t) *scanner.position();
+            scanner.scanned_ += 1;
+            scanner.pop();
+            static constexpr auto payload_steps = payload_step_functions<T>(
+                    std::make_index_sequence<codec<T>::payloads_count>());
+            if (payload_steps[tag] != nullptr)
+                scanner.push(payload_steps[tag]);
+            return scan_status::complete;
+        }
+    }
 
-template<Pair T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.first, buffer, bytes_to_write)
-           && serialize(to_serialize.second, buffer, bytes_to_write);
-}
+    template<typename T>
+    static constexpr auto field_step_functions() {
+        if constexpr (Pair<T>) {
+            return std::array<step_function, 2>{&step<typename T::first_type>, &step<typename T::second_type>};
+        } else {
+            return std::apply([](auto... field) {
+                return std::array<step_function, sizeof...(field)>{&step<field_type<decltype(field)>>...};
+            }, message_schema<T>::fields);
+        }
+    }
 
-template<List T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write) {
-    auto size = (uint32_t) to_serialize.size();
-    auto success = serialize(size, buffer, bytes_to_write);
-    if (!success)
-        return false;
-    for (uint32_t i = 0; i < size; i++) {
-        if (!serialize((typename T::value_type) to_serialize.at(i), buffer, bytes_to_write))
-            return false;
+    // nullptr for payloads that are not encoded
+    template<typename T, size_t... I>
+    static constexpr auto payload_step_functions(std::index_sequence<I...>) {
+        return std::array<step_function, sizeof...(I)>{payload_step<typename codec<T>::template payload_type<I>>()...};
     }
-    return true;
-}
 
-template<Map T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write) {
-    auto size = (uint32_t) to_serialize.size();
-    auto success = serialize(size, buffer, bytes_to_write);
-    if (!success)
-        return false;
-    for (auto it = to_serialize.begin(); it != to_serialize.end(); it++) {
-        if (!serialize((typename T::key_type) (it->first), buffer, bytes_to_write))
-            return false;
-        if (!serialize((typename T::mapped_type) (it->second), buffer, bytes_to_write))
-            return false;
+    template<typename T>
+    static constexpr step_function payload_step() {
+        if constexpr (std::is_same_v<T, std::monostate>)
+            return nullptr;
+        else
+            return &step<T>;
     }
-    return true;
-}
 
-/* * * * * * *
- * My types  *
- * * * * * * */
+    std::array<frame, MAX_SCAN_DEPTH> stack_;
+    size_t depth_ = 0;
+    size_t scanned_ = 0;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
 
-/* Enums */
+/* = = = *
+ * PARSE *
+ * = = = */
 
-template<MyEnum T>
-bool serialize(T to_serialize, char **buffer, size_t *bytes_to_write) {
-    auto as_number = static_cast<uint8_t>(to_serialize);
-    serialize(as_number, buffer, bytes_to_write);
-    return true;
+/* Parsuje obiekt typu T.
+ * Jeżeli parsowanie zakończyło się niepowodzeniem i bytes_to_read = 0,
+ * to jedynym powodem niepowodzenia była zbyt mała ilość danych */
+template<typename T>
+std::optional<T> parse(char **buffer, size_t *bytes_to_read) {
+    message_scanner scanner;
+    scanner.start<T>();
+    auto status = scanner.scan(*buffer, *bytes_to_read);
+    if (status == scan_status::incomplete)
+        *bytes_to_read = 0;
+    if (status != scan_status::complete)
+        return {};
+    std::optional<T> result(std::in_place);
+    codec<T>::decode_unchecked(&result.value(), buffer);
+    *bytes_to_read -= scanner.scanned();
+    return result;
 }
 
-/* Structs */
+/* = = = = = = = = = = = = = = = = = *
+ * PARSING STREAM OF MESSAGES        *
+ * = = = = = = = = = = = = = = = = = */
 
-template<>
-bool serialize(ClientMessage to_serialize, char **buffer, size_t *bytes_to_write) {
-    if (!serialize(to_serialize.type, buffer, bytes_to_write))
-        return false;
-    if (to_serialize.type == ClientMessageType::Join)
-        return serialize(std::get<std::string>(to_serialize.variant), buffer, bytes_to_write);
-    else if (to_serialize.type == ClientMessageType::Move)
-        return serialize(std::get<Direction>(to_serialize.variant), buffer, bytes_to_write);
-    return true;
-}
+/* Parser komunikatów przychodzących kawałkami (TCP).
+ * Skanowanie niepełnego komunikatu jest kontynuowane po dopisaniu danych, a obiekt jest tworzony raz,
+ * gdy komunikat jest kompletny, więc każdy bajt jest skanowany i dekodowany dokładnie raz,
+ * niezależnie od tego, na ile odczytów rozłożył się komunikat. */
+template<typename T>
+class stream_parser {
+public:
+    stream_parser() {
+        scanner_.template start<T>();
+    }
 
-template<>
-bool serialize(draw_message_lobby_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.server_name, buffer, bytes_to_write) &&
-           serialize(to_serialize.players_count, buffer, bytes_to_write) &&
-           serialize(to_serialize.size_x, buffer, bytes_to_write) &&
-           serialize(to_serialize.size_y, buffer, bytes_to_write) &&
-           serialize(to_serialize.game_length, buffer, bytes_to_write) &&
-           serialize(to_serialize.explosion_radius, buffer, bytes_to_write) &&
-           serialize(to_serialize.bomb_timer, buffer, bytes_to_write) &&
-           serialize(to_serialize.players, buffer, bytes_to_write);
+    void append(const char *data, size_t size) {
+        if (consumed_ > 0 && consumed_ >= buffer_.size() / 2) { // drop parsed messages, offsets in scanner are relative
+            buffer_.erase(0, consumed_);
+            consumed_ = 0;
+        }
+        buffer_.append(data, size);
+    }
 
-}
+    // complete - next message was stored in message, incomplete - the rest of data isn't a whole message yet,
+    // invalid - data isn't a correct message
+    scan_status next(T *message) {
+        auto status = scanner_.scan(buffer_.data() + consumed_, buffer_.size() - consumed_);
+        if (status != scan_status::complete)
+            return status;
+        char *read_ptr = buffer_.data() + consumed_;
+        *message = T();
+        codec<T>::decode_unchecked(message, &read_ptr);
+        last_frame_ = {consumed_, scanner_.scanned()};
+        consumed_ += scanner_.scanned();
+        scanner_.template start<T>();
+        return status;
+    }
 
-template<>
-bool serialize(draw_message_game_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.server_name, buffer, bytes_to_write) &&
-           serialize(to_serialize.size_x, buffer, bytes_to_write) &&
-           serialize(to_serialize.size_y, buffer, bytes_to_write) &&
-           serialize(to_serialize.game_length, buffer, bytes_to_write) &&
-           serialize(to_serialize.turn, buffer, bytes_to_write) &&
-           serialize(to_serialize.players, buffer, bytes_to_write) &&
-           serialize(to_serialize.player_positions, buffer, bytes_to_write) &&
-           serialize(to_serialize.blocks, buffer, bytes_to_write) &&
-           serialize(to_serialize.bombs, buffer, bytes_to_write) &&
-           serialize(to_serialize.explosions, buffer, bytes_to_write) &&
-           serialize(to_serialize.scores, buffer, bytes_to_write);
-}
+    // Encoded bytes of the message returned by last next(), valid until append or shrink
+    std::string_view last_frame() const {
+        return {buffer_.data() + last_frame_.first, last_frame_.second};
+    }
 
-template<>
-bool serialize(DrawMessage to_serialize, char **buffer, size_t *bytes_to_write) {
-    if (!serialize(to_serialize.type, buffer, bytes_to_write))
+    // Frees memory of the buffer if all received data was already parsed
+    void shrink() {
+        if (consumed_ == buffer_.size()) {
+            std::string().swap(buffer_);
+            consumed_ = 0;
+        }
+    }
+
+private:
+    std::string buffer_;
+    size_t consumed_ = 0; // bytes of buffer_ with already parsed messages
+    std::pair<size_t, size_t> last_frame_; // <offset, size>
+    message_scanner scanner_;
+};
+
+/* = = = = = *
+ * SERIALIZE *
+ * = = = = = */
+
+// Nothing is written if value doesn't fit in the buffer
+template<typename T>
+bool serialize(const T &to_serialize, char **buffer, size_t *bytes_to_write) {
+    auto size = encoded_size(to_serialize);
+    if (*bytes_to_write < size)
         return false;
-    if (to_serialize.type == DrawMessageType::Lobby)
-        return serialize(std::get<draw_message_lobby_t>(to_serialize.variant), buffer, bytes_to_write);
-    else if (to_serialize.type == DrawMessageType::Game)
-        return serialize(std::get<draw_message_game_t>(to_serialize.variant), buffer, bytes_to_write);
-    assert(false);
-    return false;
+    codec<T>::encode(to_serialize, buffer);
+    *bytes_to_write -= size;
+    return true;
 }
 
-template<>
-bool serialize(event_bomb_placed_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.id, buffer, bytes_to_write)
-        && serialize(to_serialize.position, buffer, bytes_to_write);
-}
+/* = = = = = = = = = = = = *
+ * SCATTER-GATHER BUFFERS  *
+ * = = = = = = = = = = = = */
+
+#define SEGMENT_SIZE 4096
+
+/* Bufor z zserializowanym komunikatem podzielony na segmenty, które można wysłać jednym zapisem (gather).
+ * Segmenty są albo własnymi kawałkami wypełnianymi przez serialize, albo współdzielonymi,
+ * już zakodowanymi blokami, które nie są kopiowane. */
+class message_buffer {
+public:
+    typedef std::shared_ptr<const std::string> block;
+
+    // Serializes value at the end of the buffer, value bigger than a segment is split into its parts
+    template<typename T>
+    bool append(const T &value) {
+        auto size = encoded_size(value);
+        if (open_ == nullptr || open_->size() - segments_.back().second < size) {
+            if constexpr (has_parts<T>) {
+                if (size > SEGMENT_SIZE)
+                    return append_parts(value, [this](const auto &part) { return append(part); });
+            }
+            open_segment(std::max(size, (size_t) SEGMENT_SIZE));
+        }
+        auto &used = segments_.back().second;
+        char *write_ptr = open_->data() + used;
+        codec<T>::encode(value, &write_ptr);
+        used += size;
+        size_ += size;
+        return true;
+    }
 
-template<>
-bool serialize(event_bomb_exploded_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.id, buffer, bytes_to_write)
-        && serialize(to_serialize.robots_destroyed, buffer, bytes_to_write)
-        && serialize(to_serialize.blocks_destroyed, buffer, bytes_to_write);
-}
+    // Adds already encoded block without copying it
+    void append_block(const block &encoded) {
+        append_block(encoded, encoded->size());
+    }
 
-template<>
-bool serialize(event_player_moved_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.id, buffer, bytes_to_write)
-           && serialize(to_serialize.position, buffer, bytes_to_write);
-}
+    // Adds first size bytes of already encoded block without copying it
+    void append_block(const block &encoded, size_t size) {
+        if (size == 0)
+            return;
+        segments_.push_back({encoded, size});
+        size_ += size;
+        open_ = nullptr;
+    }
 
-template<>
-bool serialize(event_block_placed_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.position, buffer, bytes_to_write);
-}
+    // Copies contents of other buffer at the end of this one
+    void append_buffer(const message_buffer &other) {
+        if (other.size() == 0)
+            return;
+        if (open_ == nullptr || open_->size() - segments_.back().second < other.size())
+            open_segment(std::max(other.size(), (size_t) SEGMENT_SIZE));
+        auto &used = segments_.back().second;
+        other.copy_to(open_->data() + used);
+        used += other.size();
+        size_ += other.size();
+    }
 
-template<>
-bool serialize(Event to_serialize, char **buffer, size_t *bytes_to_write) {
-    if (!serialize(to_serialize.type, buffer, bytes_to_write))
-        return false;
-    switch (to_serialize.type) {
-        case EventType::BombPlaced: {
-            return serialize(std::get<event_bomb_placed_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
-        }
-        case EventType::BombExploded: {
-            return serialize(std::get<event_bomb_exploded_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
-        }
-        case EventType::PlayerMoved: {
-            return serialize(std::get<event_player_moved_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
+    size_t size() const {
+        return size_;
+    }
+
+    // Buffer sequence for gather write, Buffer has to be constructible from (const void *, size_t)
+    template<typename Buffer>
+    std::vector<Buffer> buffers() const {
+        std::vector<Buffer> result;
+        result.reserve(segments_.size());
+        for (auto &segment : segments_) {
+            result.push_back(Buffer(segment.first->data(), segment.second));
         }
-        case EventType::BlockPlaced: {
-            return serialize(std::get<event_block_placed_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
+        return result;
+    }
+
+    // destination has to have at least size() bytes
+    void copy_to(char *destination) const {
+        for (auto &segment : segments_) {
+            memcpy(destination, segment.first->data(), segment.second);
+            destination += segment.second;
         }
     }
-    return false;
-}
 
-template<>
-bool serialize(server_message_hello_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    std::cerr << "serializing players count: " << to_serialize.players_count << '\n';
-    return serialize(to_serialize.server_name, buffer, bytes_to_write)
-           && serialize(to_serialize.players_count, buffer, bytes_to_write)
-           && serialize(to_serialize.size_x, buffer, bytes_to_write)
-           && serialize(to_serialize.size_y, buffer, bytes_to_write)
-           && serialize(to_serialize.game_length, buffer, bytes_to_write)
-           && serialize(to_serialize.explosion_radius, buffer, bytes_to_write)
-           && serialize(to_serialize.bomb_timer, buffer, bytes_to_write);
-}
+    std::string to_string() const {
+        std::string result;
+        result.reserve(size_);
+        for (auto &segment : segments_) {
+            result.append(segment.first->data(), segment.second);
+        }
+        return result;
+    }
 
-template<>
-bool serialize(server_message_accepted_player_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.id, buffer, bytes_to_write)
-           && serialize(to_serialize.player, buffer, bytes_to_write);
-}
+    template<typename T>
+    static block encode_block(const T &value);
 
-template<>
-bool serialize(server_message_game_started_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.players, buffer, bytes_to_write);
-}
+private:
+    void open_segment(size_t capacity) {
+        open_ = std::make_shared<std::string>(capacity, '\0');
+        segments_.push_back({open_, 0});
+    }
 
-template<>
-bool serialize(server_message_turn_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.turn, buffer, bytes_to_write)
-           && serialize(to_serialize.events, buffer, bytes_to_write);
-}
+    std::vector<std::pair<block, size_t>> segments_; // <segment, used bytes>
+    std::shared_ptr<std::string> open_; // last segment if it is owned and can be written to
+    size_t size_ = 0;
+};
 
-template<>
-bool serialize(server_message_game_ended_t to_serialize, char **buffer, size_t *bytes_to_write) {
-    return serialize(to_serialize.scores, buffer, bytes_to_write);
+/* Serializacja do message_buffer.
+ * Wartości większe niż segment są zapisywane częściami (pole po polu, element po elemencie),
+ * więc duże komunikaty rozkładają się na wiele segmentów zamiast wymagać jednego ciągłego bufora. */
+template<typename T>
+bool serialize(const T &to_serialize, message_buffer &buffer) {
+    return buffer.append(to_serialize);
 }
 
-template<>
-bool serialize(ServerMessage to_serialize, char **buffer, size_t *bytes_to_write) {
-    if (!serialize(to_serialize.type, buffer, bytes_to_write))
-        return false;
-    switch (to_serialize.type) {
-        case ServerMessageType::Hello: {
-            return serialize(std::get<server_message_hello_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
-        }
-        case ServerMessageType::AcceptedPlayer: {
-            return serialize(std::get<server_message_accepted_player_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
-        }
-        case ServerMessageType::GameStarted: {
-            return serialize(std::get<server_message_game_started_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
-        }
-        case ServerMessageType::Turn: {
-            return serialize(std::get<server_message_turn_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
-        }
-        case ServerMessageType::GameEnded: {
-            return serialize(std::get<server_message_game_ended_t>(to_serialize.variant), buffer, bytes_to_write);
-            break;
-        }
-    }
-    return false;
+template<typename T>
+message_buffer::block message_buffer::encode_block(const T &value) {
+    message_buffer buffer;
+    if (!serialize(value, buffer))
+        return nullptr;
+    return std::make_shared<const std::string>(buffer.to_string());
 }
 
 /* = = = = = = = = = *
  * UTILITY FUNCTIONS *
  * = = = = = = = = = */
 
+std::pair<std::string, std::string> split_address(const std::string &address) {
+    size_t poss_to_split = address.find_last_of(':');
+    if (poss_to_split == std::string::npos) {
+        std::cout << "Incorrect address (" << address
+                  << ") format, use format: <(host name):(port) lub (IPv4):(port) lub (IPv6):(port)>" << std::endl;
+        exit(1);
+    }
+    auto ip = address.substr(0, poss_to_split);
+    auto port = address.substr(poss_to_split + 1);
+    return {ip, port};
+}
+
 template<typename T>
 void remove_from_vector(std::vector<T> &vec, const T &to_remove) {
     auto found = std::find(vec.begin(), vec.end(), to_remove);
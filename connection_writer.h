@@ -0,0 +1,131 @@
+#ifndef SIK_2022_CONNECTION_WRITER_H
+#define SIK_2022_CONNECTION_WRITER_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+#include "common.h"
+#include "uring.h"
+#include "tracer.h"
+
+#define WRITER_MAX_QUEUED_BYTES (64 * 1024 * 1024) // connection with more bytes waiting to be sent is closed
+
+/* = = = = = = = = = = = = = = = = = = = = *
+ * CLASS COALESCING WRITES TO A CONNECTION *
+ * = = = = = = = = = = = = = = = = = = = = */
+
+/* Kolejka komunikatów wychodzących jednego połączenia.
+ * Wszystkie komunikaty dodane zanim zapis się rozpocznie są wysyłane jednym zapisem (gather),
+ * więc seria komunikatów (np. stan gry dla nowego klienta) nie jest wysyłana w osobnych segmentach TCP.
+ * Klient, który przestał odbierać, nie może trzymać dowolnie wielu tur - po przekroczeniu
+ * WRITER_MAX_QUEUED_BYTES połączenie jest zamykane. */
+class connection_writer : public std::enable_shared_from_this<connection_writer> {
+public:
+    // Writes go through uring if it is not nullptr, through boost::asio otherwise
+    connection_writer(std::shared_ptr<boost::asio::ip::tcp::socket> socket, uring_transport *uring)
+            : socket_(std::move(socket)), uring_(uring) {}
+
+    // Can be called from any thread
+    void enqueue(std::shared_ptr<const message_buffer> buffer) {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_)
+            return;
+        queued_bytes_ += buffer->size();
+        if (queued_bytes_ > WRITER_MAX_QUEUED_BYTES) {
+            close();
+            return;
+        }
+        pending_.push_back(std::move(buffer));
+        if (!flush_scheduled_ && !write_in_progress_) {
+            flush_scheduled_ = true;
+            boost::asio::post(socket_->get_executor(),
+                              boost::bind(&connection_writer::flush, shared_from_this()));
+        }
+    }
+
+private:
+    // Reader of the connection gets eof and ends it. Socket isn't closed, so its descriptor can't be
+    // reused while a write to it is in progress. You need to have mutex_ to run this function
+    void close() {
+        closed_ = true;
+        pending_.clear();
+        boost::asio::post(socket_->get_executor(), [socket = socket_]() {
+            boost::system::error_code ignored_error;
+            socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_error);
+        });
+    }
+
+    // You need to have mutex_ to run this function
+    void finish_writing() {
+        for (auto &buffer : writing_) {
+            queued_bytes_ -= buffer->size();
+        }
+        writing_.clear();
+    }
+
+    void flush() {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        flush_scheduled_ = false;
+        start_write();
+    }
+
+    // You need to have mutex_ to run this function
+    void start_write() {
+        if (pending_.empty() || closed_)
+            return;
+        trace_span span("start write");
+        writing_.swap(pending_);
+        std::vector<boost::asio::const_buffer> buffers;
+        for (auto &buffer : writing_) {
+            for (auto &part : buffer->buffers<boost::asio::const_buffer>()) {
+                if (part.size() > 0) // e.g. lobby cache before anyone was accepted
+                    buffers.push_back(part);
+            }
+        }
+        if (buffers.empty()) { // nothing to send
+            finish_writing();
+            return;
+        }
+        write_in_progress_ = true;
+        if (uring_) {
+            std::vector<iovec> iovecs;
+            for (auto &buffer : buffers) {
+                iovecs.push_back({const_cast<void *>(buffer.data()), buffer.size()});
+            }
+            uring_->async_write(socket_->native_handle(), std::move(iovecs),
+                               boost::bind(&connection_writer::handle_write, shared_from_this(),
+                                           boost::asio::placeholders::error));
+            return;
+        }
+        boost::asio::async_write(*socket_, buffers,
+                                 boost::bind(&connection_writer::handle_write, shared_from_this(),
+                                             boost::asio::placeholders::error));
+    }
+
+    void handle_write(const boost::system::error_code &error) {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        write_in_progress_ = false;
+        finish_writing();
+        if (error) {
+            closed_ = true;
+            pending_.clear();
+            return;
+        }
+        start_write(); // send everything queued during the last write
+    }
+
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket_;
+    uring_transport *uring_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<const message_buffer>> pending_;
+    std::vector<std::shared_ptr<const message_buffer>> writing_;
+    bool flush_scheduled_ = false;
+    bool write_in_progress_ = false;
+    bool closed_ = false;
+    size_t queued_bytes_ = 0; // in pending_ and writing_
+};
+
+#endif //SIK_2022_CONNECTION_WRITER_H
@@ -0,0 +1,445 @@
+#ifndef SIK_2022_GAME_RULES_H
+#define SIK_2022_GAME_RULES_H
+
+#include <set>
+
+#include "common.h"
+#include "tile_map.h"
+#include "tracer.h"
+#include "work_stealing_pool.h"
+
+#define TURN_ARENA_INITIAL_SIZE 65536
+#define TIMER_WHEEL_SIZE 256
+#define PARALLEL_EXPLOSIONS_MIN_BOMBS 32
+
+/* = = = = = = = = = = = = = *
+ * RANDOM NUMBERS GENERATOR  *
+ * = = = = = = = = = = = = = */
+
+#define RNG_MULTIPLIER 48271
+#define RNG_MODULO 2147483647
+
+// Each number is the previous one (at first the seed) times RNG_MULTIPLIER modulo RNG_MODULO
+class random_generator {
+public:
+    explicit random_generator(uint32_t seed) : last_(seed) {}
+
+    uint32_t next() {
+        last_ = (uint32_t)(((uint64_t)last_ * RNG_MULTIPLIER) % RNG_MODULO);
+        return last_;
+    }
+
+private:
+    uint32_t last_;
+};
+
+/* = = = = = = = = = = = = = = *
+ * GAME STATE AND PLAYER MOVES *
+ * = = = = = = = = = = = = = = */
+
+enum class PlayerActionType {
+    NothingReceived,
+    Move,
+    PlaceBlock,
+    PlaceBomb
+};
+
+struct PlayerAction {
+    PlayerActionType type;
+    Direction direction = Direction::Up; // default value should never be used
+};
+
+// Nothing for Join, which isn't an action in the game
+inline std::optional<PlayerAction> player_action_from_client_message(const ClientMessage &message) {
+    PlayerAction action;
+    switch (message.type) {
+        case ClientMessageType::PlaceBomb: {
+            action.type = PlayerActionType::PlaceBomb;
+            break;
+        }
+        case ClientMessageType::PlaceBlock: {
+            action.type = PlayerActionType::PlaceBlock;
+            break;
+        }
+        case ClientMessageType::Move: {
+            action.type = PlayerActionType::Move;
+            action.direction = std::get<Direction>(message.variant);
+            break;
+        }
+        default:
+            return std::nullopt;
+    }
+    return action;
+}
+
+/* Koło czasowe bomb: bomba trafia do kubełka tury, w której wybuchnie (modulo rozmiar koła),
+ * więc w każdej turze przeglądane są tylko bomby z jednego kubełka zamiast wszystkich bomb. */
+class bomb_timer_wheel {
+public:
+    bomb_timer_wheel() : buckets_(TIMER_WHEEL_SIZE) {}
+
+    void add(BombId id, uint32_t explosion_turn) {
+        buckets_[explosion_turn % TIMER_WHEEL_SIZE].push_back({explosion_turn, id});
+    }
+
+    // Removes bombs exploding in given turn from the wheel and returns them in ascending BombId order
+    std::pmr::vector<BombId> take_exploding(uint32_t turn, std::pmr::memory_resource *resource) {
+        std::pmr::vector<BombId> result(resource);
+        auto &bucket = buckets_[turn % TIMER_WHEEL_SIZE];
+        size_t kept = 0;
+        for (auto &entry : bucket) {
+            if (entry.first == turn)
+                result.push_back(entry.second);
+            else // explodes after the wheel turns around again
+                bucket[kept++] = entry;
+        }
+        bucket.resize(kept);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+private:
+    std::vector<std::vector<std::pair<uint32_t, BombId>>> buckets_; // <explosion turn, bomb>
+};
+
+/* = = = = = = = = = = = = = = = *
+ * MEMORY FOR COMPUTING ONE TURN *
+ * = = = = = = = = = = = = = = = */
+
+/* Pamięć na zdarzenia i pomocnicze struktury jednej tury, zwalniana w całości po rozesłaniu tury.
+ * Jeżeli tura nie zmieściła się w buforze, przed następną turą bufor jest powiększany,
+ * więc po kilku turach liczenie tury nie wywołuje już malloc. */
+class turn_arena {
+public:
+    turn_arena() : memory_size_(TURN_ARENA_INITIAL_SIZE), memory_(new std::byte[memory_size_]) {
+        arena_.emplace(memory_.get(), memory_size_, &overflow_);
+    }
+
+    std::pmr::memory_resource *resource() {
+        return &arena_.value();
+    }
+
+    // All objects allocated in the arena have to be destroyed before calling this
+    void reset() {
+        arena_.reset();
+        if (overflow_.allocated > 0) {
+            memory_size_ = 2 * (memory_size_ + overflow_.allocated);
+            memory_.reset(new std::byte[memory_size_]);
+            overflow_.allocated = 0;
+        }
+        arena_.emplace(memory_.get(), memory_size_, &overflow_);
+    }
+
+private:
+    // Counts memory that didn't fit in the buffer
+    struct overflow_resource : public std::pmr::memory_resource {
+        size_t allocated = 0;
+
+        void *do_allocate(size_t bytes, size_t alignment) override {
+            allocated += bytes;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void *ptr, size_t bytes, size_t alignment) override {
+            std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    size_t memory_size_;
+    std::unique_ptr<std::byte[]> memory_;
+    overflow_resource overflow_;
+    std::optional<std::pmr::monotonic_buffer_resource> arena_;
+};
+
+/* = = = = = = = = = = = *
+ * RESOLVING EXPLOSIONS  *
+ * = = = = = = = = = = = */
+
+/* Promienie wybuchu każdej bomby są liczone niezależnie, względem bloków sprzed wybuchów,
+ * więc przy wielu bombach mogą być liczone równolegle. Blok trafiony przez kilka bomb niszczy
+ * tylko pierwsza z nich (w kolejności BombId), a promienie kolejnych przez niego przechodzą -
+ * to jest doliczane sekwencyjnie przy scalaniu wyników, więc zdarzenia są takie same
+ * jak przy liczeniu bomb po kolei. */
+
+const std::array<Position, 4> explosion_directions{{{1, 0}, {0, 1}, {-1, 0}, {0, -1}}};
+
+struct explosion_rays_t {
+    std::array<uint16_t, 4> reach; // distance reached in each direction
+    std::array<bool, 4> blocked; // ray stopped on a block at its reach
+    std::vector<PlayerId> players; // ascending
+};
+
+inline Position explosion_position(Position bomb, size_t direction, uint16_t distance) {
+    bomb.first += (uint16_t)(explosion_directions[direction].first * distance);
+    bomb.second += (uint16_t)(explosion_directions[direction].second * distance);
+    return bomb;
+}
+
+/* = = = = = = = = = = = = = *
+ * RULES OF ONE GAME         *
+ * = = = = = = = = = = = = = */
+
+struct game_parameters {
+    uint16_t size_x;
+    uint16_t size_y;
+    uint16_t game_length;
+    uint16_t explosion_radius;
+    uint16_t bomb_timer;
+    uint16_t initial_blocks;
+};
+
+/* Stan jednej rozgrywki i zasady gry, bez żadnej komunikacji - używany przez serwer
+ * i przez symulację wielu gier naraz. Liczby losowe pochodzą z generatora podanego przez
+ * wywołującego, więc te same ziarno i akcje graczy dają te same zdarzenia. */
+struct game_state {
+    TurnNo turn_no = 0;
+    player_table players;
+    bomb_table bombs;
+    bomb_timer_wheel bomb_wheel;
+    BombId next_bomb_id = 0;
+    tile_map blocks;
+    std::vector<PlayerAction> selected_actions; // indexed by PlayerId, cleared after each turn
+
+    game_state() = default;
+
+    // Explosions are computed by explosion_pool if it isn't nullptr
+    game_state(const game_parameters &parameters, work_stealing_pool *explosion_pool)
+            : parameters_(parameters), explosion_pool_(explosion_pool) {}
+
+    bool ended() const {
+        return turn_no > parameters_.game_length;
+    }
+
+    // Events of turn 0: players are placed in given order and then initial blocks are placed
+    void start(const std::vector<PlayerId> &ids, random_generator &rng, std::pmr::vector<Event> *events) {
+        for (auto id : ids) {
+            auto x = uint16_t (rng.next() % parameters_.size_x);
+            auto y = uint16_t (rng.next() % parameters_.size_y);
+            Position position{x, y};
+            events->push_back({
+                EventType::PlayerMoved,
+                event_player_moved_t({
+                    id,
+                    position
+                })
+            });
+            players.add(id, position);
+        }
+        PlayerAction no_action;
+        no_action.type = PlayerActionType::NothingReceived;
+        selected_actions.assign(players.x.size(), no_action);
+        for (uint16_t i = 0; i < parameters_.initial_blocks; i++) {
+            auto x = uint16_t (rng.next() % parameters_.size_x);
+            auto y = uint16_t (rng.next() % parameters_.size_y);
+            Position position{x, y};
+            if (!blocks.insert(position))
+                continue;
+            events->push_back({
+                EventType::BlockPlaced,
+                event_block_placed_t({
+                    position
+                })
+            });
+        }
+    }
+
+    // Events of turn turn_no: bombs explode, then destroyed players are moved and others do selected actions.
+    // Players are visited in ascending PlayerId order, which fixes the order of random draws and BombIds.
+    // Turn number is incremented by the caller.
+    void compute_turn(random_generator &rng, std::pmr::vector<Event> *events) {
+        auto resource = events->get_allocator().resource();
+        std::pmr::set<PlayerId> destroyed_players(resource);
+        std::pmr::set<Position> blocks_to_remove(resource);
+        std::pmr::vector<BombId> exploding_bombs(resource);
+        {
+            trace_span span("bomb tick");
+            exploding_bombs = bomb_wheel.take_exploding(turn_no, resource);
+        }
+        {
+            trace_span span("explosions");
+            resolve_explosions(exploding_bombs, events, &destroyed_players, &blocks_to_remove);
+            for (const auto &block : blocks_to_remove) {
+                blocks.erase(block);
+            }
+            for (auto bomb_id : exploding_bombs) { // remove bombs that exploded
+                bombs.erase(bomb_id);
+            }
+        }
+        trace_span span("player actions");
+        for (auto id : players.ids) {
+            auto current_position = players.position(id);
+            if (destroyed_players.contains(id)) {
+                auto x = uint16_t (rng.next() % parameters_.size_x);
+                auto y = uint16_t (rng.next() % parameters_.size_y);
+                Position position{x, y};
+                events->push_back({
+                    EventType::PlayerMoved,
+                    event_player_moved_t({
+                        id,
+                        position
+                    })
+                });
+                players.set_position(id, position); // zapisanie zmiany pozycji
+            } else { // player wasn't destroyed
+                auto action = selected_actions[id];
+                switch (action.type) {
+                    case PlayerActionType::NothingReceived: {
+                        // nothing to do
+                        break;
+                    }
+                    case PlayerActionType::PlaceBlock: {
+                        blocks.insert(current_position);
+                        events->push_back({
+                            EventType::BlockPlaced,
+                            event_block_placed_t({
+                                current_position
+                            })
+                        });
+                        break;
+                    }
+                    case PlayerActionType::PlaceBomb: {
+                        auto new_bomb_id = next_bomb_id;
+                        next_bomb_id++;
+                        uint32_t explosion_turn = turn_no + parameters_.bomb_timer;
+                        bombs.add(new_bomb_id, current_position, explosion_turn);
+                        bomb_wheel.add(new_bomb_id, explosion_turn);
+                        events->push_back({
+                           EventType::BombPlaced,
+                           event_bomb_placed_t({
+                               new_bomb_id,
+                               current_position
+                           })
+                        });
+                        break;
+                    }
+                    case PlayerActionType::Move: {
+                        std::pair<int, int> new_position = {
+                                (int)current_position.first,
+                                (int)current_position.second
+                        };
+                        if (action.direction == Direction::Up) {
+                            new_position.second++;
+                        } else if (action.direction == Direction::Right) {
+                            new_position.first++;
+                        } else if (action.direction == Direction::Down) {
+                            new_position.second--;
+                        } else /*if (action.direction == Direction::Left)*/ {
+                            new_position.first--;
+                        }
+                        if (!blocks.contains(new_position)
+                            && new_position.first >= 0 && new_position.first < parameters_.size_x
+                            && new_position.second >= 0 && new_position.second < parameters_.size_y) { // check if position is allowed
+                            Position new_position_verified = {
+                                    (uint16_t)new_position.first,
+                                    (uint16_t)new_position.second
+                            };
+                            events->push_back({
+                                EventType::PlayerMoved,
+                                event_player_moved_t({
+                                    id,
+                                    new_position_verified
+                                })
+                            });
+                            players.set_position(id, new_position_verified); // update position in game state
+                        }
+                        break;
+                    }
+                }
+                // clear action that was already handled
+                selected_actions[id].type = PlayerActionType::NothingReceived;
+            }
+        }
+    }
+
+private:
+    // Follows ray starting at given distance until it hits a block, returns distance reached
+    uint16_t cast_ray(Position bomb, size_t direction, uint16_t from, bool *blocked) const {
+        auto dx = (int16_t) explosion_directions[direction].first;
+        auto dy = (int16_t) explosion_directions[direction].second;
+        auto distance = blocks.first_on_ray(bomb, dx, dy, from, parameters_.explosion_radius);
+        *blocked = distance <= parameters_.explosion_radius;
+        return (uint16_t) std::min(distance, (uint32_t) parameters_.explosion_radius);
+    }
+
+    std::vector<PlayerId> players_in_rays(Position bomb, const std::array<uint16_t, 4> &reach) const {
+        std::vector<PlayerId> result;
+        for (auto id : players.ids) {
+            auto position = players.position(id);
+            // distances wrap around the same way as explosion positions
+            auto right = (uint16_t)(position.first - bomb.first);
+            auto up = (uint16_t)(position.second - bomb.second);
+            auto left = (uint16_t)(bomb.first - position.first);
+            auto down = (uint16_t)(bomb.second - position.second);
+            if ((up == 0 && (right <= reach[0] || left <= reach[2]))
+                || (right == 0 && (up <= reach[1] || down <= reach[3])))
+                result.push_back(id);
+        }
+        return result;
+    }
+
+    // Only reads the state, can be run by many threads at once
+    void compute_explosion_rays(Position bomb, explosion_rays_t *rays) const {
+        for (size_t direction = 0; direction < explosion_directions.size(); direction++) {
+            rays->reach[direction] = cast_ray(bomb, direction, 0, &rays->blocked[direction]);
+        }
+        rays->players = players_in_rays(bomb, rays->reach);
+    }
+
+    // Bombs are given in ascending BombId order, blocks are removed from the board by the caller
+    void resolve_explosions(const std::pmr::vector<BombId> &exploding_bombs, std::pmr::vector<Event> *events,
+                            std::pmr::set<PlayerId> *destroyed_players, std::pmr::set<Position> *blocks_to_remove) {
+        auto resource = events->get_allocator().resource();
+        std::pmr::vector<explosion_rays_t> bomb_rays(exploding_bombs.size(), resource);
+        auto compute = [&](size_t i){
+            auto bomb_position = bombs.position(bombs.find(exploding_bombs[i]));
+            compute_explosion_rays(bomb_position, &bomb_rays[i]);
+        };
+        if (explosion_pool_ && exploding_bombs.size() >= PARALLEL_EXPLOSIONS_MIN_BOMBS) {
+            explosion_pool_->run(exploding_bombs.size(), compute);
+        } else {
+            for (size_t i = 0; i < exploding_bombs.size(); i++) {
+                compute(i);
+            }
+        }
+
+        for (size_t i = 0; i < exploding_bombs.size(); i++) {
+            auto bomb_position = bombs.position(bombs.find(exploding_bombs[i]));
+            auto &rays = bomb_rays[i];
+            bool extended = false;
+            std::pmr::set<Position> blocks_destroyed_by_bomb(resource);
+            for (size_t direction = 0; direction < explosion_directions.size(); direction++) {
+                // block already destroyed by an earlier bomb doesn't stop the ray
+                while (rays.blocked[direction]
+                       && blocks_to_remove->contains(explosion_position(bomb_position, direction, rays.reach[direction]))) {
+                    rays.reach[direction] = cast_ray(bomb_position, direction, (uint16_t)(rays.reach[direction] + 1),
+                                                     &rays.blocked[direction]);
+                    extended = true;
+                }
+                if (rays.blocked[direction])
+                    blocks_destroyed_by_bomb.insert(explosion_position(bomb_position, direction, rays.reach[direction]));
+            }
+            if (extended)
+                rays.players = players_in_rays(bomb_position, rays.reach);
+            destroyed_players->insert(rays.players.begin(), rays.players.end());
+            blocks_to_remove->insert(blocks_destroyed_by_bomb.begin(), blocks_destroyed_by_bomb.end());
+            events->push_back({
+                EventType::BombExploded,
+                event_bomb_exploded_t({
+                    exploding_bombs[i],
+                    std::pmr::vector<PlayerId>(rays.players.begin(), rays.players.end(), resource),
+                    std::pmr::vector<Position>(blocks_destroyed_by_bomb.begin(), blocks_destroyed_by_bomb.end(),
+                                               resource)
+                })
+            });
+        }
+    }
+
+    game_parameters parameters_{};
+    work_stealing_pool *explosion_pool_ = nullptr;
+};
+
+#endif //SIK_2022_GAME_RULES_H
@@ -0,0 +1,62 @@
+#ifndef SIK_2022_MPSC_QUEUE_H
+#define SIK_2022_MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+/* = = = = = = = = = = = = = = = = = = = = = *
+ * LOCK-FREE MULTI PRODUCER SINGLE CONSUMER  *
+ * = = = = = = = = = = = = = = = = = = = = = */
+
+/* Kolejka, do której wiele wątków dodaje elementy bez blokowania (CAS na głowie listy),
+ * a jeden wątek zabiera naraz wszystkie elementy (exchange głowy na nullptr).
+ * Konsument nigdy nie zdejmuje pojedynczych elementów, więc nie ma problemu ABA. */
+template<typename T>
+class mpsc_queue {
+public:
+    mpsc_queue() = default;
+
+    ~mpsc_queue() {
+        drain([](const T &) {});
+    }
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    // Can be run by many threads at once
+    void push(T value) {
+        auto new_node = new node{std::move(value), head_.load(std::memory_order_relaxed)};
+        while (!head_.compare_exchange_weak(new_node->next, new_node,
+                                            std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    // Takes all elements from the queue and calls action for each of them in order of pushing.
+    // Only one thread can run this function at a time.
+    template<typename Action>
+    void drain(Action &&action) {
+        node *list = head_.exchange(nullptr, std::memory_order_acquire);
+        node *reversed = nullptr; // list is in reverse order of pushing
+        while (list) {
+            auto next = list->next;
+            list->next = reversed;
+            reversed = list;
+            list = next;
+        }
+        while (reversed) {
+            action(reversed->value);
+            auto next = reversed->next;
+            delete reversed;
+            reversed = next;
+        }
+    }
+
+private:
+    struct node {
+        T value;
+        node *next;
+    };
+
+    std::atomic<node *> head_ = nullptr;
+};
+
+#endif //SIK_2022_MPSC_QUEUE_H
@@ -0,0 +1,303 @@
+#include <iostream>
+#include <string>
+#include <boost/program_options.hpp>
+#include <boost/array.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/asio.hpp>
+
+#include "common.h"
+#include "connection_writer.h"
+#include "slot_map.h"
+
+#define BUFFER_SIZE 80000
+
+namespace p_opt = boost::program_options;
+
+using boost::asio::ip::tcp;
+
+// program parameters
+uint16_t port;
+bool use_io_uring;
+
+std::unique_ptr<uring_transport> uring; // nullptr if messages are sent through boost::asio
+
+/* = = = = = = = = = = = = = = = *
+ * STREAM RECEIVED FROM SERVER   *
+ * = = = = = = = = = = = = = = = */
+
+/* Ramki są przechowywane dokładnie w takiej postaci, w jakiej przyszły od serwera,
+ * więc klienci relay'a (także kolejne relay'e) dostają bajt w bajt ten sam strumień.
+ * Wszystko działa w jednym wątku io_context, więc dane nie są chronione mutexem. */
+struct stream_cache_t {
+    std::shared_ptr<const message_buffer> hello;
+    std::vector<std::shared_ptr<const message_buffer>> accepted_players; // since the last GameEnded
+    std::shared_ptr<const message_buffer> game_started; // nullptr if game is not played
+    std::vector<std::shared_ptr<const message_buffer>> turns;
+};
+
+stream_cache_t stream_cache;
+slot_map<std::shared_ptr<connection_writer>> downstream_writers;
+
+void send_to_all_clients(std::shared_ptr<const message_buffer> frame) {
+    if (uring) // one copy to registered memory shared by writes to all clients
+        frame = uring->registered_copy(frame);
+    for (auto &writer : downstream_writers) {
+        writer->enqueue(frame);
+    }
+}
+
+void process_frame(const ServerMessage &message, const std::shared_ptr<const message_buffer> &frame) {
+    switch (message.type) {
+        case ServerMessageType::Hello: {
+            if (stream_cache.hello)
+                return; // Ignore more than one hello message
+            stream_cache.hello = frame;
+            break;
+        }
+        case ServerMessageType::AcceptedPlayer: {
+            stream_cache.accepted_players.push_back(frame);
+            break;
+        }
+        case ServerMessageType::GameStarted: {
+            stream_cache.game_started = frame;
+            stream_cache.turns.clear();
+            break;
+        }
+        case ServerMessageType::Turn: {
+            stream_cache.turns.push_back(frame);
+            break;
+        }
+        case ServerMessageType::GameEnded: {
+            stream_cache.game_started = nullptr;
+            stream_cache.turns.clear();
+            stream_cache.accepted_players.clear();
+            break;
+        }
+    }
+    send_to_all_clients(frame);
+}
+
+/* = = = = = = = = = = = = = = = = = = = *
+ * CLASS HANDLING CONNECTION WITH SERVER *
+ * = = = = = = = = = = = = = = = = = = = */
+
+class upstream_connection {
+public:
+    upstream_connection(boost::asio::io_context &io_context, const std::string &server_address,
+                        const std::string &server_port) : server_socket_(io_context) {
+        tcp::resolver resolver(io_context);
+        tcp::resolver::results_type server_endpoints;
+        try {
+            server_endpoints = resolver.resolve(server_address, server_port);
+        } catch (std::exception &e) {
+            std::cerr << "Error: resolving server address failed" << std::endl;
+            exit(1);
+        }
+        try {
+            boost::asio::connect(server_socket_, server_endpoints);
+        } catch (std::exception &e) {
+            std::cerr << "Error: connecting to server failed" << std::endl;
+            exit(1);
+        }
+
+        boost::asio::ip::tcp::no_delay no_delay_option(true);
+        server_socket_.set_option(no_delay_option);
+
+        start_receive();
+    }
+
+private:
+    void start_receive() {
+        server_socket_.async_receive(
+                boost::asio::buffer(server_recv_buffer_),
+                boost::bind(&upstream_connection::handle_receive, this,
+                            boost::asio::placeholders::error,
+                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void handle_receive(const boost::system::error_code &error, std::size_t bytes_transferred) {
+        if (error == boost::asio::error::eof) {
+            std::cerr << "Error: connection with server closed" << std::endl;
+            exit(1);
+        } else if (error) {
+            std::cerr << "Error: receiving message from server failed" << std::endl;
+            exit(1);
+        }
+
+        server_stream_.append(server_recv_buffer_.data(), bytes_transferred);
+
+        ServerMessage server_message;
+        while (true) {
+            auto status = server_stream_.next(&server_message);
+            if (status == scan_status::incomplete) {
+                // Part of the message hasn't been received yet, waiting for the rest of it
+                break;
+            } else if (status == scan_status::invalid) {
+                std::cerr << "Error: incorrect message from server" << std::endl;
+                exit(1);
+            }
+            // Correct message, forward exactly the bytes it was parsed from
+            auto encoded = server_stream_.last_frame();
+            auto frame = std::make_shared<message_buffer>();
+            frame->append_block(std::make_shared<const std::string>(encoded));
+            process_frame(server_message, frame);
+        }
+
+        start_receive();
+    }
+
+    tcp::socket server_socket_;
+    boost::array<char, BUFFER_SIZE> server_recv_buffer_;
+    stream_parser<ServerMessage> server_stream_;
+};
+
+/* = = = = = = = = = = = = = = = = = = = = *
+ * CLASS HANDLING CONNECTION WITH OBSERVER *
+ * = = = = = = = = = = = = = = = = = = = = */
+
+/* Relay obsługuje tylko obserwatorów - komunikaty od klientów są odczytywane i pomijane,
+ * bo wszyscy klienci dzielą jedno połączenie z serwerem. */
+class relay_connection : public boost::enable_shared_from_this<relay_connection> {
+public:
+    typedef boost::shared_ptr<relay_connection> pointer;
+
+    ~relay_connection() {
+        if (started_)
+            downstream_writers.erase(registry_id_);
+    }
+
+    static pointer create(boost::asio::io_context &io_context) {
+        return pointer(new relay_connection(io_context));
+    }
+
+    tcp::socket &socket() {
+        return *socket_;
+    }
+
+    void start() {
+        boost::asio::ip::tcp::no_delay no_delay_option(true);
+        socket_->set_option(no_delay_option);
+        registry_id_ = downstream_writers.insert(writer_);
+        started_ = true;
+        send_current_state();
+        start_receive();
+    }
+
+private:
+    relay_connection(boost::asio::io_context &io_context)
+            : socket_(new tcp::socket(io_context)), writer_(new connection_writer(socket_, uring.get())) {}
+
+    // Late joiners are served from the cache, all frames go out in one write
+    void send_current_state() {
+        if (!stream_cache.hello)
+            return; // everything will be forwarded when it arrives from the server
+        writer_->enqueue(stream_cache.hello);
+        if (stream_cache.game_started) {
+            writer_->enqueue(stream_cache.game_started);
+            for (auto &turn : stream_cache.turns) {
+                writer_->enqueue(turn);
+            }
+        } else {
+            for (auto &accepted_player : stream_cache.accepted_players) {
+                writer_->enqueue(accepted_player);
+            }
+        }
+    }
+
+    void start_receive() {
+        socket_->async_receive(
+                boost::asio::buffer(recv_buffer_),
+                boost::bind(&relay_connection::handle_receive, shared_from_this(),
+                            boost::asio::placeholders::error,
+                            boost::asio::placeholders::bytes_transferred));
+    }
+
+    void handle_receive(const boost::system::error_code &error, std::size_t /*bytes_transferred*/) {
+        if (error)
+            return;
+        start_receive();
+    }
+
+    std::shared_ptr<tcp::socket> socket_;
+    std::shared_ptr<connection_writer> writer_;
+    boost::array<char, 512> recv_buffer_;
+    slot_id registry_id_; // in downstream_writers
+    bool started_ = false;
+};
+
+/* = = = = = = = = = = = = = = = = = = = = = = = *
+ * CLASS HANDLING ACCEPTING INCOMING CONNECTIONS *
+ * = = = = = = = = = = = = = = = = = = = = = = = */
+
+class relay_server {
+public:
+    relay_server(boost::asio::io_context &io_context)
+            : io_context_(io_context),
+              acceptor_(io_context, tcp::endpoint(tcp::v6(), port)) {
+        start_accept();
+    }
+
+private:
+    void start_accept() {
+        relay_connection::pointer new_connection = relay_connection::create(io_context_);
+
+        acceptor_.async_accept(new_connection->socket(),
+                               boost::bind(&relay_server::handle_accept, this, new_connection,
+                                           boost::asio::placeholders::error));
+    }
+
+    void handle_accept(relay_connection::pointer new_connection, const boost::system::error_code &error) {
+        if (!error) {
+            new_connection->start();
+        }
+
+        start_accept();
+    }
+
+    boost::asio::io_context &io_context_;
+    tcp::acceptor acceptor_;
+};
+
+int main(int argc, char *argv[]) {
+    std::string server_address;
+    try {
+        p_opt::options_description description("Allowed options");
+        description.add_options()
+                ("help,h", "Wypisuje jak używać programu")
+                ("server-address,s", p_opt::value<std::string>(&server_address)->required(),
+                 "<(nazwa hosta):(port) lub (IPv4):(port) lub (IPv6):(port)> serwera lub innego relay'a")
+                ("port,p", p_opt::value<uint16_t>(&port)->required(),
+                 "port na którym relay nasłuchuje na połączenia od obserwatorów")
+                ("io-uring", p_opt::bool_switch(&use_io_uring),
+                 "(opcjonalny) wysyłanie komunikatów przez io_uring zamiast boost::asio");
+
+        p_opt::variables_map var_map;
+        p_opt::store(p_opt::parse_command_line(argc, argv, description), var_map);
+
+        if (var_map.count("help")) {
+            std::cout << description << "\n";
+            return 0;
+        }
+
+        p_opt::notify(var_map);
+    }
+    catch (std::exception &e) {
+        std::cout << e.what() << '\n';
+        return 1;
+    }
+
+    boost::asio::io_context io_context;
+    if (use_io_uring) {
+        uring = uring_transport::create(io_context);
+        if (!uring)
+            std::cerr << "Warning: io_uring is not available, using boost::asio" << std::endl;
+    }
+    auto split_server_address = split_address(server_address);
+    upstream_connection upstream(io_context, split_server_address.first, split_server_address.second);
+    relay_server server(io_context);
+    io_context.run();
+
+    return 0;
+}
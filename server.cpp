@@ -9,8 +9,15 @@
 #include <queue>
 
 #include "common.h"
-
-#define BUFFER_SIZE 80000
+#include "connection_writer.h"
+#include "work_stealing_pool.h"
+#include "mpsc_queue.h"
+#include "buffer_pool.h"
+#include "slot_map.h"
+#include "tile_map.h"
+#include "game_rules.h"
+#include "tracer.h"
+#include "allocation_stats.h"
 
 namespace p_opt = boost::program_options;
 
@@ -25,64 +32,87 @@ uint16_t initial_blocks;
 uint16_t game_length;
 std::string server_name;
 uint16_t port;
-uint32_t seed; // later holds last generated random numer
+uint32_t seed;
 uint16_t size_x;
 uint16_t size_y;
-
-/* = = = = = = = = = = = = = *
- * RANDOM NUMBERS GENERATOR  *
- * = = = = = = = = = = = = = */
-
-#define RNG_MULTIPLIER 48271
-#define RNG_MODULO 2147483647
-
-std::mutex rng_mutex;
-
-uint32_t get_nex_random() {
-    const std::lock_guard<std::mutex> lock(rng_mutex);
-    auto new_random = (uint32_t)(((uint64_t)seed * RNG_MULTIPLIER) % RNG_MODULO);
-    seed = new_random;
-    return new_random;
-}
+bool use_io_uring;
+uint32_t max_connections;
+uint32_t input_rate; // messages per second from one client, 0 means no limit
+uint32_t input_burst;
+uint16_t explosion_threads;
+uint16_t acceptors_count;
+bool print_input_stats;
+std::string trace_file; // empty if spans aren't traced
+
+std::unique_ptr<uring_transport> uring; // nullptr if messages are sent through boost::asio
+std::unique_ptr<work_stealing_pool> explosion_pool; // nullptr if explosions are computed by one thread
+buffer_pool receive_buffers; // shared by all connections
+random_generator rng(0); // seeded in main, used only by the game state thread
+allocation_report allocations; // printed after each turn if built with ALLOCATION_STATS
 
 /* = = = = = = = = = = *
- * DATA KEPT BY SERVER *
+ * INPUT RATE LIMITING *
  * = = = = = = = = = = */
 
-enum class PlayerActionType {
-    NothingReceived,
-    Move,
-    PlaceBlock,
-    PlaceBomb
-};
+// Token bucket, each action from a client takes one token, tokens are refilled at input_rate per second
+class token_bucket {
+public:
+    token_bucket() : tokens_(input_burst), last_refill_(std::chrono::steady_clock::now()) {}
+
+    bool take() {
+        if (input_rate == 0)
+            return true;
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = now - last_refill_;
+        last_refill_ = now;
+        tokens_ = std::min((double) input_burst, tokens_ + elapsed.count() * input_rate);
+        if (tokens_ < 1)
+            return false;
+        tokens_ -= 1;
+        return true;
+    }
 
-struct PlayerAction {
-    PlayerActionType type;
-    Direction direction = Direction::Up; // default value should never be used
+private:
+    double tokens_;
+    std::chrono::steady_clock::time_point last_refill_;
 };
 
-ServerMessage hello_message; // hello message is always the same
+/* = = = = = = = = = = *
+ * DATA KEPT BY SERVER *
+ * = = = = = = = = = = */
 
 std::mutex data_mutex;
 
 struct game_data_t {
-    TurnNo turn_no = 0; // or 1 ??? TODO
-    std::vector<server_message_turn_t> turns;
-    std::unordered_map<PlayerId, Position> players_positions;
-    std::unordered_map<PlayerId, Score> scores;
-    std::unordered_map<BombId, Bomb> bombs;
-    BombId next_bomb_id = 0;
-    std::set<Position> blocks;
-    std::unordered_map<PlayerId, PlayerAction> selected_actions;
+    game_state state; // computed by the game state thread
+    std::vector<std::shared_ptr<const message_buffer>> turns; // encoded, sent to clients connecting during the game
+    std::vector<uint32_t> discarded_inputs; // in the last turn, indexed by PlayerId
+};
+
+/* Akcje graczy nie trafiają od razu do game_data - wątki sieciowe wrzucają je bez blokowania
+ * do kolejki, oznaczone numerem tury, w której mają być wykonane. Na początku tury kolejka
+ * jest opróżniana w całości, z akcji jednego gracza wygrywa ostatnia, a pozostałe są liczone
+ * jako odrzucone. */
+struct received_input {
+    PlayerId player_id;
+    uint32_t lobby; // lobby_number of the player's game, entries from earlier games are dropped
+    uint32_t turn; // turn in which the action should be applied, 0 if game wasn't played
+    PlayerAction action;
 };
 
+mpsc_queue<received_input> input_queue;
+std::atomic<uint32_t> input_turn = 0; // stamped on received actions
+
 bool is_game_played = false;
 std::condition_variable conditional_game_started;
 PlayerId next_player_id = 0;
 std::unordered_map<PlayerId, Player> accepted_players;
 game_data_t game_data;
 
-std::vector<std::pair<std::shared_ptr<tcp::socket>, std::shared_ptr<bool>>> clients_sockets;
+slot_map<std::shared_ptr<connection_writer>> clients_writers;
+// Incremented when game ends, so all players who joined earlier stop playing at once. Read without data_mutex.
+std::atomic<uint32_t> lobby_number = 1;
+std::atomic<uint32_t> connections_count = 0; // slot is reserved when accepting and freed when connection ends
 
 //std::condition_variable conditional_new_data;
 //std::mutex mutex_new_data;
@@ -91,18 +121,99 @@ std::vector<std::pair<std::shared_ptr<tcp::socket>, std::shared_ptr<bool>>> clie
  * UTILITY FUNCTIONS *
  * = = = = = = = = = */
 
-// You need to have data_mutex to run this function
-void send_to_all_clients(const ServerMessage &message) {
-    char buff[BUFFER_SIZE];
-    for (auto &socket_flag_pair : clients_sockets) {
-        auto client_socket = socket_flag_pair.first;
-        char *buff_ptr = buff;
-        size_t buff_size = BUFFER_SIZE;
-        assert(serialize(message, &buff_ptr, &buff_size));
+std::shared_ptr<message_buffer> serialize_message(const ServerMessage &message) {
+    auto buffer = std::make_shared<message_buffer>();
+    [[maybe_unused]] bool serialized = serialize(message, *buffer);
+    assert(serialized);
+    return buffer;
+}
+
+/* = = = = = = = = = = = = = = = *
+ * CACHE OF ENCODED MESSAGES     *
+ * = = = = = = = = = = = = = = = */
+
+/* Komunikaty wysyłane każdemu nowemu klientowi są trzymane jako gotowe bufory,
+ * współdzielone przez wszystkie połączenia. Hello jest kodowany raz przy starcie serwera,
+ * a GameStarted i lista AcceptedPlayer są kodowane ponownie tylko po zmianie lobby lub fazy gry,
+ * więc podłączenie się klienta nie wymaga kodowania żadnego komunikatu. */
+class message_cache {
+public:
+    void set_hello(const ServerMessage &hello) {
+        hello_ = serialize_message(hello);
+    }
+
+    std::shared_ptr<const message_buffer> hello() const {
+        return hello_;
+    }
+
+    // You need to have data_mutex to run this function
+    // Encodes AcceptedPlayer message of the player who joined the lobby
+    std::shared_ptr<const message_buffer> player_accepted(PlayerId id, const Player &player) {
+        auto encoded = serialize_message(ServerMessage({
+            ServerMessageType::AcceptedPlayer,
+            server_message_accepted_player_t({id, player})
+        }));
+        accepted_players_.push_back(encoded);
+        lobby_ = nullptr;
+        game_started_ = nullptr;
+        return encoded;
+    }
+
+    // You need to have data_mutex to run this function
+    // AcceptedPlayer messages of all players in the lobby, in one buffer
+    std::shared_ptr<const message_buffer> lobby() {
+        if (!lobby_) {
+            auto buffer = std::make_shared<message_buffer>();
+            for (auto &accepted_player : accepted_players_) {
+                buffer->append_buffer(*accepted_player);
+            }
+            lobby_ = buffer;
+        }
+        return lobby_;
+    }
 
-        boost::system::error_code ignored_error;
-        boost::asio::write(*client_socket, boost::asio::buffer(buff, BUFFER_SIZE - buff_size), ignored_error);
+    // You need to have data_mutex to run this function
+    std::shared_ptr<const message_buffer> game_started() {
+        if (!game_started_) {
+            auto buffer = std::make_shared<message_buffer>();
+            buffer->append(ServerMessageType::GameStarted);
+            buffer->append(accepted_players);
+            game_started_ = buffer;
+        }
+        return game_started_;
     }
+
+    // You need to have data_mutex to run this function
+    // Called when the game ends and a new lobby is started
+    void clear_lobby() {
+        accepted_players_.clear();
+        lobby_ = nullptr;
+        game_started_ = nullptr;
+    }
+
+private:
+    std::shared_ptr<const message_buffer> hello_; // always the same
+    std::vector<std::shared_ptr<const message_buffer>> accepted_players_; // in order of joining
+    std::shared_ptr<const message_buffer> lobby_; // nullptr if it has to be encoded again
+    std::shared_ptr<const message_buffer> game_started_; // nullptr if it has to be encoded again
+};
+
+message_cache cached_messages;
+
+// You need to have data_mutex to run this function
+void send_to_all_clients(std::shared_ptr<const message_buffer> buffer) {
+    trace_span span("send to all clients");
+    if (uring) // one copy to registered memory shared by writes to all clients
+        buffer = uring->registered_copy(buffer);
+    for (auto &writer : clients_writers) {
+        trace_span writer_span("enqueue");
+        writer->enqueue(buffer);
+    }
+}
+
+// You need to have data_mutex to run this function
+void send_to_all_clients(const ServerMessage &message) {
+    send_to_all_clients(serialize_message(message));
 }
 
 /* = = = = = = = = = = = = = = = = = = = *
@@ -114,8 +225,11 @@ public:
     typedef boost::shared_ptr<player_connection> pointer;
 
     ~player_connection() {
+        if (!started_)
+            return; // rejected or never accepted, nothing to clean up
+        connections_count--;
         const std::lock_guard<std::mutex> lock(data_mutex);
-        remove_from_vector(clients_sockets, {socket_, is_playing_});
+        clients_writers.erase(registry_id_);
     }
 
     static pointer create(boost::asio::io_context& io_context) {
@@ -126,161 +240,134 @@ public:
         return *socket_;
     }
 
-    void send_message(const ServerMessage &message) {
-        char buff[BUFFER_SIZE];
-        char *buff_ptr = buff;
-        size_t buff_size = BUFFER_SIZE;
-        assert(serialize(message, &buff_ptr, &buff_size));
-
-        boost::asio::async_write(*socket_, boost::asio::buffer(buff, BUFFER_SIZE - buff_size),
-                                 boost::bind(&player_connection::handle_write, shared_from_this(),
-                                             boost::asio::placeholders::error,
-                                             boost::asio::placeholders::bytes_transferred));
+    void send_buffer(std::shared_ptr<const message_buffer> buffer) {
+        writer_->enqueue(std::move(buffer));
     }
 
     void start() {
         boost::asio::ip::tcp::no_delay no_delay_option(true);
         socket_->set_option(no_delay_option);
-        send_message(hello_message);
+        socket_->non_blocking(true); // reads are done only after the socket is readable
+        started_ = true; // slot in connections_count was reserved by the acceptor
+        {
+            // Registering and sending the current state under one lock, so that no broadcast can get in between
+            const std::lock_guard<std::mutex> lock(data_mutex);
+            registry_id_ = clients_writers.insert(writer_);
+            send_buffer(cached_messages.hello());
+            send_current_state();
+        }
         start_receive();
     }
 
 private:
     player_connection(boost::asio::io_context& io_context)
-            : socket_(new tcp::socket(io_context)), is_playing_(new bool(false)) {
-        const std::lock_guard<std::mutex> lock(data_mutex);
-        clients_sockets.push_back({socket_, is_playing_});
-        socket_->is_open();
+            : socket_(new tcp::socket(io_context)), writer_(new connection_writer(socket_, uring.get())) {}
+
+    bool is_playing() const {
+        return joined_lobby_ == lobby_number;
     }
 
+    // You need to have data_mutex to run this function
     void send_current_state() {
-        const std::lock_guard<std::mutex> lock(data_mutex);
         if (is_game_played) { // send game started and turns of current game
-            ServerMessage game_started_message({
-                ServerMessageType::GameStarted,
-                server_message_game_started_t({
-                    accepted_players
-                })
-            });
+            send_buffer(cached_messages.game_started());
             for (auto &turn : game_data.turns) {
-                ServerMessage turn_message({
-                    ServerMessageType::Turn,
-                    turn
-                });
-                send_message(turn_message);
+                send_buffer(turn);
             }
         } else { // send accepted players
-            for (auto &player : accepted_players) {
-                ServerMessage message({
-                    ServerMessageType::AcceptedPlayer,
-                    server_message_accepted_player_t({
-                        player.first,
-                        player.second
-                    })
-                });
-                send_message(message);
-            }
+            send_buffer(cached_messages.lobby());
         }
     }
 
+    // Waits until data can be read without taking any buffer, so idle connections don't hold memory
     void start_receive() {
-        socket_->async_receive(
-                boost::asio::buffer(recv_buffer_),
-                boost::bind(&player_connection::handle_receive, shared_from_this() /* this */,
-                            boost::asio::placeholders::error,
-                            boost::asio::placeholders::bytes_transferred));
+        socket_->async_wait(
+                tcp::socket::wait_read,
+                boost::bind(&player_connection::handle_readable, shared_from_this() /* this */,
+                            boost::asio::placeholders::error));
     }
 
-    void handle_receive(
-            const boost::system::error_code &error,
-            std::size_t bytes_transferred) {
-        if (error == boost::asio::error::eof) {
+    void handle_readable(const boost::system::error_code &error) {
+        if (error)
+            return;
+        trace_span span("handle receive");
+
+        boost::system::error_code read_error;
+        {
+            auto buffer = receive_buffers.take(read_size_class_);
+            auto bytes_transferred = socket_->receive(boost::asio::buffer(buffer.data(), buffer.size()), 0,
+                                                      read_error);
+            if (!read_error)
+                stream_.append(buffer.data(), bytes_transferred);
+            // Bigger buffer next time if this one was filled, smaller if it was mostly empty
+            if (bytes_transferred == buffer.size() && read_size_class_ + 1 < BUFFER_POOL_CLASSES)
+                read_size_class_++;
+            else if (bytes_transferred < buffer.size() / 4 && read_size_class_ > 0)
+                read_size_class_--;
+        }
+        if (read_error == boost::asio::error::would_block) {
+            start_receive();
             return;
-        } else if (error) {
+        } else if (read_error) { // including eof
             return;
         }
 
-        std::string received(recv_buffer_.data(), bytes_transferred);
-        saved_buffer_ += received;
-
-        while (!saved_buffer_.empty()) {
-            char *buff = saved_buffer_.data();
-            auto bytes_to_read = (size_t) saved_buffer_.size();
-            auto message = parse<ClientMessage>(&buff, &bytes_to_read);
-            if (!message && bytes_to_read == 0) {
+        ClientMessage message;
+        while (true) {
+            scan_status status;
+            {
+                allocation_phase_scope phase(AllocationPhase::Parse);
+                status = stream_.next(&message);
+            }
+            if (status == scan_status::incomplete) {
                 // Part of the message hasn't been received yet, waiting for the rest of it
                 break;
-            } else if (!message) {
+            } else if (status == scan_status::invalid) {
                 // Message was incorrect, disconnect
                 return;
             }
             // Correct message
-            auto parsed_size = (size_t) (buff - saved_buffer_.data());
-            saved_buffer_.erase(0, parsed_size);
-            handle_message(message.value());
+            if (message.type == ClientMessageType::Join)
+                handle_join(message); // never dropped, otherwise the client could never be accepted
+            else if (input_limit_.take())
+                handle_action(message);
+            // else client sends too fast, action is dropped
         }
+        stream_.shrink();
         start_receive(); // Wait for nex message
     }
 
-    void handle_message(ClientMessage &message) {
+    void handle_join(ClientMessage &message) {
         const std::lock_guard<std::mutex> lock(data_mutex);
-        switch (message.type) {
-            case ClientMessageType::Join: {
-                if (*is_playing_ || is_game_played || accepted_players.size() == players_count)
-                    return;
-                auto player_name = std::get<std::string>(message.variant);
-                Player player = {player_name, get_client_address()};
-                player_id_ = next_player_id;
-                next_player_id++;
-                accepted_players.insert({
-                    player_id_,
-                    player
-                });
-                *is_playing_ = true;
-
-                ServerMessage accepted_player_message({
-                    ServerMessageType::AcceptedPlayer,
-                    server_message_accepted_player_t({
-                        player_id_,
-                        player
-                    })});
-                send_to_all_clients(accepted_player_message);
-
-                if (accepted_players.size() == players_count) {
-                    conditional_game_started.notify_all();
-                }
-                break;
-            }
-            case ClientMessageType::PlaceBomb: {
-                if (is_playing_) {
-                    PlayerAction action;
-                    action.type = PlayerActionType::PlaceBomb;
-                    game_data.selected_actions[player_id_] = action;
-                }
-                break;
-            }
-            case ClientMessageType::PlaceBlock: {
-                if (is_playing_) {
-                    PlayerAction action;
-                    action.type = PlayerActionType::PlaceBlock;
-                    game_data.selected_actions[player_id_] = action;
-                }
-                break;
-            }
-            case ClientMessageType::Move: {
-                if (is_playing_) {
-                    PlayerAction action;
-                    action.type = PlayerActionType::Move;
-                    action.direction = std::get<Direction>(message.variant);
-                    game_data.selected_actions[player_id_] = action;
-                }
-                break;
-            }
+        if (is_playing() || is_game_played || accepted_players.size() == players_count)
+            return;
+        auto player_name = std::get<std::string>(message.variant);
+        Player player = {player_name, get_client_address()};
+        player_id_ = next_player_id;
+        next_player_id++;
+        accepted_players.insert({
+            player_id_,
+            player
+        });
+        joined_lobby_ = lobby_number.load();
+
+        send_to_all_clients(cached_messages.player_accepted(player_id_, player));
+
+        if (accepted_players.size() == players_count) {
+            conditional_game_started.notify_all();
         }
     }
 
-    void handle_write(const boost::system::error_code& /*error*/,
-                      size_t /*bytes_transferred*/) {}
+    // Doesn't take data_mutex, action is applied by the game state thread at the beginning of a turn
+    void handle_action(ClientMessage &message) {
+        uint32_t lobby = joined_lobby_;
+        if (lobby != lobby_number)
+            return;
+        auto action = player_action_from_client_message(message); // Join is handled by handle_join
+        if (!action)
+            return;
+        input_queue.push({player_id_, lobby, input_turn.load(), action.value()});
+    }
 
     std::string get_client_address() {
         std::string result;
@@ -302,21 +389,37 @@ private:
     }
 
     std::shared_ptr<tcp::socket> socket_;
-    boost::array<char, BUFFER_SIZE> recv_buffer_;
-    std::string saved_buffer_;
+    std::shared_ptr<connection_writer> writer_;
+    size_t read_size_class_ = 0; // of buffer taken from receive_buffers
+    stream_parser<ClientMessage> stream_;
     PlayerId player_id_;
-    std::shared_ptr<bool> is_playing_;
+    std::atomic<uint32_t> joined_lobby_ = 0; // lobby_number at the time of joining, 0 if never joined
+    slot_id registry_id_; // in clients_writers
+    token_bucket input_limit_;
+    bool started_ = false;
 };
 
 /* = = = = = = = = = = = = = = = = = = = = = = = *
  * CLASS HANDLING ACCEPTING INCOMING CONNECTIONS *
  * = = = = = = = = = = = = = = = = = = = = = = = */
 
+/* Przy acceptors_count > 1 każdy tcp_server ma własny io_context i wątek, a wszystkie acceptory
+ * są zbindowane na ten sam port z SO_REUSEPORT, więc jądro rozdziela między nie nowe połączenia.
+ * Połączenie jest obsługiwane w wątku acceptora, który je przyjął, a stan gry jest wspólny (data_mutex). */
 class tcp_server {
 public:
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
     tcp_server(boost::asio::io_context& io_context)
             : io_context_(io_context),
-              acceptor_(io_context, tcp::endpoint(tcp::v6(), port)) {
+              acceptor_(io_context) {
+        tcp::endpoint endpoint(tcp::v6(), port);
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+        if (acceptors_count > 1)
+            acceptor_.set_option(reuse_port(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
         start_accept();
     }
 
@@ -330,8 +433,14 @@ private:
                                            boost::asio::placeholders::error));
     }
 
+    // Slot is reserved with one fetch_add, so acceptors accepting at the same time can't exceed max_connections
     void handle_accept(player_connection::pointer new_connection, const boost::system::error_code& error) {
-        if (!error) {
+        if (!error && connections_count.fetch_add(1) >= max_connections && max_connections != 0) {
+            // Too many connections, reject before touching any game data
+            connections_count--;
+            boost::system::error_code ignored_error;
+            new_connection->socket().close(ignored_error);
+        } else if (!error) {
             new_connection->start();
         }
 
@@ -343,225 +452,200 @@ private:
 };
 
 void start_accepting_connections(boost::asio::io_context& io_context) {
+    trace_thread_name("acceptor");
     tcp_server server(io_context);
     io_context.run();
 }
 
-void manage_game_state(boost::asio::io_context& io_context) {
+/* = = = = = = = = = = *
+ * BROADCASTING TURNS  *
+ * = = = = = = = = = = */
+
+/* Tura jest kodowana i dodawana do kolejek połączeń w osobnym wątku, a w tym czasie wątek stanu gry
+ * liczy już następną turę. Naraz rozsyłana jest co najwyżej jedna tura, więc wątek stanu gry
+ * trzyma dwa zestawy pamięci tury i używa ich na zmianę. */
+class turn_broadcaster {
+public:
+    turn_broadcaster() : thread_(&turn_broadcaster::broadcast_loop, this) {}
+
+    ~turn_broadcaster() {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        thread_.join();
+    }
+
+    // Waits until the previous turn was sent, turn has to stay valid until it is sent too
+    void broadcast(const server_message_turn_t *turn) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]{ return pending_ == nullptr; });
+        pending_ = turn;
+        work_available_.notify_one();
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]{ return pending_ == nullptr; });
+    }
+
+private:
+    void broadcast_loop() {
+        trace_thread_name("turn broadcaster");
+        while (true) {
+            const server_message_turn_t *turn;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_available_.wait(lock, [this]{ return stopping_ || pending_ != nullptr; });
+                if (pending_ == nullptr)
+                    return;
+                turn = pending_;
+            }
+            send_turn(*turn);
+            {
+                const std::lock_guard<std::mutex> lock(mutex_);
+                pending_ = nullptr;
+            }
+            idle_.notify_all();
+        }
+    }
+
+    static void send_turn(const server_message_turn_t &turn) {
+        auto turn_buffer = std::make_shared<message_buffer>();
+        {
+            trace_span span("encode turn");
+            allocation_phase_scope phase(AllocationPhase::Encode);
+            turn_buffer->append(ServerMessageType::Turn);
+            [[maybe_unused]] bool serialized = serialize(turn, *turn_buffer);
+            assert(serialized);
+        }
+        // Late joiners get turns from game_data, so adding and sending has to be done under one lock
+        const std::lock_guard<std::mutex> lock(data_mutex);
+        game_data.turns.push_back(turn_buffer);
+        send_to_all_clients(turn_buffer);
+    }
+
+    std::mutex mutex_; // guards fields below
+    std::condition_variable work_available_;
+    std::condition_variable idle_;
+    const server_message_turn_t *pending_ = nullptr;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+// Only the game state thread runs this function
+// Applies actions received since the previous turn, from each player only the last one is kept
+void apply_received_inputs() {
+    uint32_t turn = game_data.state.turn_no;
+    input_turn = turn + 1; // actions received from now on are stamped with the next turn
+    auto players_size = game_data.state.selected_actions.size();
+    game_data.discarded_inputs.assign(players_size, 0);
+    std::vector<bool> received(players_size, false);
+    input_queue.drain([&](const received_input &input) {
+        if (input.lobby != lobby_number || input.player_id >= players_size)
+            return; // from a player of the previous game
+        // Actions sent in the lobby (stamped 0) are dropped, stamp turn + 1 means the action came during draining
+        if (input.turn == 0 || (input.turn != turn && input.turn != turn + 1)) {
+            game_data.discarded_inputs[input.player_id]++;
+            return;
+        }
+        if (received[input.player_id])
+            game_data.discarded_inputs[input.player_id]++;
+        received[input.player_id] = true;
+        game_data.state.selected_actions[input.player_id] = input.action;
+    });
+    if (print_input_stats) {
+        for (PlayerId id = 0; id < players_size; id++) {
+            if (game_data.discarded_inputs[id] != 0)
+                std::cerr << "turn " << turn << ": discarded " << game_data.discarded_inputs[id]
+                          << " inputs of player " << (int) id << std::endl;
+        }
+    }
+}
+
+// Memory of one turn, kept until the turn is sent
+struct turn_memory {
+    turn_arena arena;
+    std::optional<server_message_turn_t> turn;
+};
+
+void manage_game_state() {
+    trace_thread_name("game state");
+    turn_broadcaster broadcaster;
+    std::array<turn_memory, 2> turns_memory; // one is computed while the other one is sent
+    size_t current_memory = 0;
+    auto next_turn_time = std::chrono::steady_clock::now();
     while (true) {
+        auto &memory = turns_memory[current_memory];
+        memory.turn.reset();
+        memory.arena.reset(); // turn from this memory was already sent
+        auto &arena = memory.arena;
         {
-            std::vector<Event> events;
-            std::unique_lock<std::mutex> lock(data_mutex);
+            std::pmr::vector<Event> events(arena.resource());
+            // Only this thread changes is_game_played and computes turns, so the lock is needed
+            // just when state seen by connections changes
+            std::unique_lock<std::mutex> lock(data_mutex, std::defer_lock);
             if (!is_game_played) { // wait until game starts
+                lock.lock();
                 conditional_game_started.wait(lock, []{return accepted_players.size() == players_count;});
+                next_turn_time = std::chrono::steady_clock::now();
 
 
                 is_game_played = true;
                 game_data = game_data_t(); // wyczyszczenie danych o grze
+                game_data.state = game_state({size_x, size_y, game_length, explosion_radius, bomb_timer,
+                                              initial_blocks}, explosion_pool.get());
+                allocation_phase_scope phase(AllocationPhase::TurnCompute);
+                std::vector<PlayerId> ids;
                 for (auto &player : accepted_players) {
-                    auto id = player.first;
-                    auto x = uint16_t (get_nex_random() % size_x);
-                    auto y = uint16_t (get_nex_random() % size_y);
-                    Position position{x, y};
-                    events.push_back({
-                        EventType::PlayerMoved,
-                        event_player_moved_t({
-                            id,
-                            position
-                        })
-                    });
-                    game_data.players_positions.insert({id, position});
-                    game_data.scores.insert({id, 0});
-                    PlayerAction action;
-                    action.type = PlayerActionType::NothingReceived;
-                    game_data.selected_actions.insert({id, action});
-                }
-                for (uint16_t i = 0; i < initial_blocks; i++) {
-                    auto x = uint16_t (get_nex_random() % size_x);
-                    auto y = uint16_t (get_nex_random() % size_y);
-                    Position position{x, y};
-                    if (game_data.blocks.contains(position))
-                        continue;
-                    game_data.blocks.insert(position);
-                    events.push_back({
-                        EventType::BlockPlaced,
-                        event_block_placed_t({
-                            position
-                        })
-                    });
+                    ids.push_back(player.first);
                 }
+                game_data.state.start(ids, rng, &events);
+                apply_received_inputs();
 
-                ServerMessage game_started_message({
-                    ServerMessageType::GameStarted,
-                    server_message_game_started_t({
-                        accepted_players
-                    })
-                });
-                send_to_all_clients(game_started_message);
+                send_to_all_clients(cached_messages.game_started());
 
             } else { // next turn
-                if (game_data.turn_no > game_length) { // game ended
+                if (game_data.state.ended()) { // game ended
+                    broadcaster.wait_idle(); // last turn has to be sent before GameEnded
+                    lock.lock();
                     ServerMessage game_ended_message{
                         ServerMessageType::GameEnded,
                         server_message_game_ended_t{
-                            game_data.scores
+                            game_data.state.players.scores_map()
                         }
                     };
                     send_to_all_clients(game_ended_message);
                     is_game_played = false;
-                    for (auto &socket_flag : clients_sockets) {
-                        *socket_flag.second = false;
-                    }
+                    input_turn = 0;
+                    lobby_number++;
+                    // Actions of this game left in the queue, the ones pushed later are dropped by their lobby
+                    input_queue.drain([](const received_input &) {});
                     accepted_players = {};
+                    cached_messages.clear_lobby();
                     next_player_id = 0;
                     continue;
                 }
 
-                std::set<PlayerId> destroyed_players;
-                std::set<BombId> bombs_to_remove;
-                std::set<Position> blocks_to_remove;
-                for (auto &bomb : game_data.bombs) {
-                    bomb.second.second--; // decrease bomb timer;
-                    if (bomb.second.second == 0) { // bomb explodes
-                        bombs_to_remove.insert(bomb.first);
-                        std::set<PlayerId> players_destroyed_by_bomb;
-                        std::set<Position> blocks_destroyed_by_bomb;
-                        std::vector<Position> directions{{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
-                        auto destroy_on_position = [&](const Position &pos){
-                            for (const auto &player : game_data.players_positions) {
-                                if (player.second == pos) {
-                                    destroyed_players.insert(player.first);
-                                    players_destroyed_by_bomb.insert(player.first);
-                                }
-                            }
-                            if (game_data.blocks.contains(pos)) {
-                                blocks_destroyed_by_bomb.insert(pos);
-                                blocks_to_remove.insert(pos);
-                                return true;
-                            }
-                            return false;
-                        };
-                        for (const auto &direction : directions) {
-                            for (uint16_t i = 0; i <= explosion_radius; i++) {
-                                auto explosion_position = bomb.second.first;
-                                explosion_position.first += (uint16_t)(direction.first * i);
-                                explosion_position.second += (uint16_t)(direction.second * i);
-                                if (destroy_on_position(explosion_position))
-                                    break;
-                            }
-                        }
-                        for (const auto &block : blocks_destroyed_by_bomb) {
-                            game_data.blocks.erase(block);
-                        }
-                        events.push_back({
-                            EventType::BombExploded,
-                            event_bomb_exploded_t({
-                                bomb.first,
-                                std::vector(players_destroyed_by_bomb.begin(), players_destroyed_by_bomb.end()),
-                                std::vector(blocks_destroyed_by_bomb.begin(), blocks_destroyed_by_bomb.end())
-                            })
-                        });
-                    }
-                }
-                for (auto &bomb : bombs_to_remove) { // remove bombs that exploded
-                    game_data.bombs.erase(bomb);
-                }
-                for (auto &player : game_data.players_positions) {
-                    auto id = player.first;
-                    auto current_position = player.second;
-                    if (destroyed_players.contains(id)) {
-                        auto x = uint16_t (get_nex_random() % size_x);
-                        auto y = uint16_t (get_nex_random() % size_y);
-                        Position position{x, y};
-                        events.push_back({
-                            EventType::PlayerMoved,
-                            event_player_moved_t({
-                                id,
-                                position
-                            })
-                        });
-                        player.second = position; // zapisanie zmiany pozycji w game_data
-                    } else { // player wasn't destroyed
-                        auto action = game_data.selected_actions[id];
-                        switch (action.type) {
-                            case PlayerActionType::NothingReceived: {
-                                // nothing to do
-                                break;
-                            }
-                            case PlayerActionType::PlaceBlock: {
-                                game_data.blocks.insert(current_position);
-                                events.push_back({
-                                    EventType::BlockPlaced,
-                                    event_block_placed_t({
-                                        current_position
-                                    })
-                                });
-                                break;
-                            }
-                            case PlayerActionType::PlaceBomb: {
-                                auto new_bomb_id = game_data.next_bomb_id;
-                                game_data.next_bomb_id++;
-                                game_data.bombs.insert({new_bomb_id, {current_position, bomb_timer}});
-                                events.push_back({
-                                   EventType::BombPlaced,
-                                   event_bomb_placed_t({
-                                       new_bomb_id,
-                                       current_position
-                                   })
-                                });
-                                break;
-                            }
-                            case PlayerActionType::Move: {
-                                std::pair<int, int> new_position = {
-                                        (int)current_position.first,
-                                        (int)current_position.second
-                                };
-                                if (action.direction == Direction::Up) {
-                                    new_position.second++;
-                                } else if (action.direction == Direction::Right) {
-                                    new_position.first++;
-                                } else if (action.direction == Direction::Down) {
-                                    new_position.second--;
-                                } else /*if (action.direction == Direction::Left)*/ {
-                                    new_position.first--;
-                                }
-                                if (!game_data.blocks.contains(new_position)
-                                    && new_position.first >= 0 && new_position.first < size_x
-                                    && new_position.second >= 0 && new_position.second < size_y) { // check if position is allowed
-                                    Position new_position_verified = {
-                                            (uint16_t)new_position.first,
-                                            (uint16_t)new_position.second
-                                    };
-                                    events.push_back({
-                                        EventType::PlayerMoved,
-                                        event_player_moved_t({
-                                            id,
-                                            new_position_verified
-                                        })
-                                    });
-                                    player.second = new_position_verified; // update position in game data
-                                }
-                                break;
-                            }
-                        }
-                        // clear action that was already handled
-                        game_data.selected_actions[id].type = PlayerActionType::NothingReceived;
-                    }
-                }
+                trace_span span("compute turn");
+                allocation_phase_scope phase(AllocationPhase::TurnCompute);
+                apply_received_inputs();
+                game_data.state.compute_turn(rng, &events);
             }
-            server_message_turn_t turn{
-                    game_data.turn_no,
+            memory.turn.emplace(server_message_turn_t{
+                    game_data.state.turn_no,
                     std::move(events)
-            };
-            game_data.turns.push_back(turn);
-            send_to_all_clients(ServerMessage{
-                    ServerMessageType::Turn,
-                    std::move(turn)
             });
-            game_data.turn_no++;
+            broadcaster.broadcast(&memory.turn.value());
+            allocations.print(game_data.state.turn_no);
+            current_memory = 1 - current_memory;
+            game_data.state.turn_no++;
         }
-        boost::asio::deadline_timer t(io_context, boost::posix_time::milliseconds(turn_duration));
-        t.wait();
+        // Next turn is computed at its deadline, even if this one is still being sent
+        next_turn_time = std::max(next_turn_time + std::chrono::milliseconds(turn_duration),
+                                  std::chrono::steady_clock::now());
+        std::this_thread::sleep_until(next_turn_time);
     }
 }
 
@@ -587,7 +671,26 @@ int main(int argc, char *argv[]) {
                 ("seed,s", p_opt::value<uint32_t>(&seed)->default_value((uint32_t) time_now),
                  "(opcjonalny) seed wykorzystywane przez generator liczb losowych")
                 ("size-x,x", p_opt::value<uint16_t>(&size_x)->required(), "rozmiar planszy wzdłuż osi x")
-                ("size-y,y", p_opt::value<uint16_t>(&size_y)->required(), "rozmiar planszy wzdłuż osi y");
+                ("size-y,y", p_opt::value<uint16_t>(&size_y)->required(), "rozmiar planszy wzdłuż osi y")
+                ("io-uring", p_opt::bool_switch(&use_io_uring),
+                 "(opcjonalny) wysyłanie komunikatów przez io_uring zamiast boost::asio")
+                ("max-connections", p_opt::value<uint32_t>(&max_connections)->default_value(0),
+                 "(opcjonalny) maksymalna liczba jednoczesnych połączeń, 0 oznacza brak limitu")
+                ("input-rate", p_opt::value<uint32_t>(&input_rate)->default_value(0),
+                 "(opcjonalny) liczba akcji na sekundę przyjmowanych od jednego klienta (Join nie jest liczony), "
+                 "0 oznacza brak limitu")
+                ("input-burst", p_opt::value<uint32_t>(&input_burst)->default_value(20),
+                 "(opcjonalny) liczba akcji, które klient może wysłać naraz ponad input-rate, musi być dodatnia "
+                 "przy włączonym limicie")
+                ("explosion-threads", p_opt::value<uint16_t>(&explosion_threads)->default_value(1),
+                 "(opcjonalny) liczba wątków liczących wybuchy bomb")
+                ("acceptors", p_opt::value<uint16_t>(&acceptors_count)->default_value(1),
+                 "(opcjonalny) liczba wątków przyjmujących połączenia (SO_REUSEPORT), każdy z własnym io_context")
+                ("input-stats", p_opt::bool_switch(&print_input_stats),
+                 "(opcjonalny) wypisywanie na stderr liczby odrzuconych akcji graczy w każdej turze")
+                ("trace", p_opt::value<std::string>(&trace_file),
+                 "(opcjonalny) plik, do którego zapisywane są czasy faz tury i obsługi połączeń "
+                 "(format Chrome trace event)");
 
         p_opt::variables_map var_map;
         p_opt::store(p_opt::parse_command_line(argc, argv, description), var_map);
@@ -604,9 +707,23 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     players_count = (uint8_t)players_count_to_load;
+    rng = random_generator(seed);
+    if (input_rate != 0 && input_burst == 0) {
+        std::cout << "Input burst has to be positive when input rate is limited\n";
+        return 1;
+    }
+
+    std::unique_ptr<trace_writer> tracer;
+    if (!trace_file.empty()) {
+        tracer = std::make_unique<trace_writer>(trace_file, "robots-server");
+        if (!tracer->is_open()) {
+            std::cerr << "Error: opening trace file failed" << std::endl;
+            return 1;
+        }
+    }
 
     // Create hello message
-    hello_message = {
+    cached_messages.set_hello({
             ServerMessageType::Hello,
             server_message_hello_t({
                 server_name,
@@ -617,12 +734,32 @@ int main(int argc, char *argv[]) {
                 explosion_radius,
                 bomb_timer
             })
-    };
+    });
 
     boost::asio::io_context io_context;
-    std::thread accepting_connections_thread(start_accepting_connections, std::ref(io_context));
-    std::thread manage_game_state_thread(manage_game_state, std::ref(io_context));
-    accepting_connections_thread.join();
+    if (use_io_uring) {
+        uring = uring_transport::create(io_context);
+        if (!uring)
+            std::cerr << "Warning: io_uring is not available, using boost::asio" << std::endl;
+    }
+    if (explosion_threads > 1)
+        explosion_pool = std::make_unique<work_stealing_pool>(explosion_threads);
+    if (acceptors_count == 0)
+        acceptors_count = 1;
+    // The first acceptor uses io_context shared with io_uring and game state thread
+    std::vector<std::unique_ptr<boost::asio::io_context>> acceptor_io_contexts;
+    for (uint16_t i = 1; i < acceptors_count; i++) {
+        acceptor_io_contexts.push_back(std::make_unique<boost::asio::io_context>());
+    }
+    std::vector<std::thread> accepting_connections_threads;
+    accepting_connections_threads.emplace_back(start_accepting_connections, std::ref(io_context));
+    for (auto &acceptor_io_context : acceptor_io_contexts) {
+        accepting_connections_threads.emplace_back(start_accepting_connections, std::ref(*acceptor_io_context));
+    }
+    std::thread manage_game_state_thread(manage_game_state);
+    for (auto &accepting_connections_thread : accepting_connections_threads) {
+        accepting_connections_thread.join();
+    }
     manage_game_state_thread.join();
     return 0;
 }
\ No newline at end of file
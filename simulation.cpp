@@ -0,0 +1,215 @@
+#include <iostream>
+#include <set>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include "common.h"
+#include "game_rules.h"
+#include "work_stealing_pool.h"
+#include "bot.h"
+
+namespace p_opt = boost::program_options;
+
+// program parameters
+game_parameters parameters;
+uint8_t players_count;
+uint32_t first_seed;
+uint32_t games_count;
+std::string policy;
+uint16_t threads_count;
+
+/* = = = = = = = = = = = = = = = = = = *
+ * SIMULATION OF MANY GAMES AT ONCE    *
+ * = = = = = = = = = = = = = = = = = = */
+
+/* Każda gra jest liczona od początku do końca w jednym wątku, bez gniazd i bez czekania na turę,
+ * według tych samych zasad (game_state) i z tym samym generatorem liczb losowych co serwer:
+ * gra z ziarnem s to gra serwera uruchomionego z --seed s, w której gracze wysyłają te same akcje.
+ * Gry są rozdzielane między wątki przez work_stealing_pool. */
+
+struct game_stats {
+    uint32_t turns = 0;
+    uint32_t bombs = 0;
+    uint32_t explosions = 0;
+    uint32_t blocks_destroyed = 0;
+    size_t blocks_left = 0;
+    std::vector<Score> scores; // indexed by PlayerId, counted like by the client (robot destroyed)
+};
+
+// Action of each player for the next turn, decided after events of the previous turn
+class players_policy {
+public:
+    // Random actions don't use the generator of the game, so the game is the same as on the server
+    explicit players_policy(uint32_t seed) : rng_(seed % (RNG_MODULO - 1) + 1) {
+        if (policy == "bot") {
+            for (PlayerId id = 0; id < players_count; id++) {
+                bots_.emplace_back(parameters.size_x, parameters.size_y, parameters.explosion_radius,
+                                   parameters.bomb_timer);
+            }
+        }
+    }
+
+    void choose_actions(const std::pmr::vector<Event> &events, game_state *state) {
+        if (policy == "random") {
+            for (auto id : state->players.ids) {
+                auto random = rng_.next() % 8;
+                if (random < 4)
+                    state->selected_actions[id] = {PlayerActionType::Move, (Direction) random};
+                else if (random == 4)
+                    state->selected_actions[id] = {PlayerActionType::PlaceBomb};
+                else if (random == 5)
+                    state->selected_actions[id] = {PlayerActionType::PlaceBlock};
+                // else nothing
+            }
+        } else if (policy == "bot") {
+            std::vector<Position> positions;
+            for (auto id : state->players.ids) {
+                positions.push_back(state->players.position(id));
+            }
+            for (auto id : state->players.ids) {
+                bots_[id].turn_events(events, state->blocks);
+                std::vector<Position> enemies;
+                for (auto other : state->players.ids) {
+                    if (other != id)
+                        enemies.push_back(state->players.position(other));
+                }
+                auto message = bots_[id].choose_action(state->players.position(id), enemies, state->blocks);
+                if (message)
+                    state->selected_actions[id] = player_action_from_client_message(message.value()).value();
+            }
+        } // else policy "idle", nobody does anything
+    }
+
+private:
+    random_generator rng_;
+    std::vector<bot_player> bots_; // indexed by PlayerId
+};
+
+void count_events(const std::pmr::vector<Event> &events, game_stats *stats) {
+    std::set<PlayerId> destroyed_players; // robot hit by many bombs in one turn is destroyed once
+    for (auto &event : events) {
+        if (event.type == EventType::BombPlaced) {
+            stats->bombs++;
+        } else if (event.type == EventType::BombExploded) {
+            auto &event_desc = std::get<event_bomb_exploded_t>(event.variant);
+            stats->explosions++;
+            stats->blocks_destroyed += (uint32_t) event_desc.blocks_destroyed.size();
+            destroyed_players.insert(event_desc.robots_destroyed.begin(), event_desc.robots_destroyed.end());
+        }
+    }
+    for (auto id : destroyed_players) {
+        stats->scores[id]++;
+    }
+}
+
+game_stats simulate_game(uint32_t seed) {
+    game_stats stats;
+    stats.scores.assign(players_count, 0);
+    random_generator rng(seed);
+    game_state state(parameters, nullptr);
+    players_policy players(seed);
+
+    // Players are placed in the order the server iterates over accepted players
+    std::unordered_map<PlayerId, Player> accepted_players;
+    for (PlayerId id = 0; id < players_count; id++) {
+        accepted_players.insert({id, {"bot" + std::to_string(id), ""}});
+    }
+    std::vector<PlayerId> ids;
+    for (auto &player : accepted_players) {
+        ids.push_back(player.first);
+    }
+
+    turn_arena arena;
+    {
+        std::pmr::vector<Event> events(arena.resource());
+        state.start(ids, rng, &events);
+        players.choose_actions(events, &state);
+    }
+    state.turn_no++;
+    while (!state.ended()) {
+        arena.reset();
+        std::pmr::vector<Event> events(arena.resource());
+        state.compute_turn(rng, &events);
+        count_events(events, &stats);
+        players.choose_actions(events, &state);
+        state.turn_no++;
+    }
+    stats.turns = state.turn_no;
+    stats.blocks_left = state.blocks.size();
+    return stats;
+}
+
+int main(int argc, char *argv[]) {
+    uint16_t players_count_to_load;
+    try {
+        p_opt::options_description description("Allowed options");
+        description.add_options()
+                ("help,h", "Wypisuje jak używać programu")
+                ("bomb-timer,b", p_opt::value<uint16_t>(&parameters.bomb_timer)->required(), "czas do wybuchu bomby w turach")
+                ("players-count,c", p_opt::value<uint16_t>(&players_count_to_load)->required(), "liczba grających graczy")
+                ("explosion-radius,e", p_opt::value<uint16_t>(&parameters.explosion_radius)->required(),
+                 "promień wybuchu bomby")
+                ("initial-blocks,k", p_opt::value<uint16_t>(&parameters.initial_blocks)->required(),
+                 "początkowa liczba bloków na mapie")
+                ("game-length,l", p_opt::value<uint16_t>(&parameters.game_length)->required(), "liczba tur w rozgrywce")
+                ("size-x,x", p_opt::value<uint16_t>(&parameters.size_x)->required(), "rozmiar planszy wzdłuż osi x")
+                ("size-y,y", p_opt::value<uint16_t>(&parameters.size_y)->required(), "rozmiar planszy wzdłuż osi y")
+                ("seed,s", p_opt::value<uint32_t>(&first_seed)->default_value(1),
+                 "(opcjonalny) seed pierwszej gry, kolejne gry mają kolejne seedy")
+                ("games,g", p_opt::value<uint32_t>(&games_count)->default_value(1000),
+                 "(opcjonalny) liczba symulowanych gier")
+                ("policy", p_opt::value<std::string>(&policy)->default_value("random"),
+                 "(opcjonalny) zachowanie graczy: idle (nic nie robią), random (losowe akcje) lub bot")
+                ("threads,t", p_opt::value<uint16_t>(&threads_count)->default_value(
+                        (uint16_t) std::max(std::thread::hardware_concurrency(), 1u)),
+                 "(opcjonalny) liczba wątków symulujących gry");
+
+        p_opt::variables_map var_map;
+        p_opt::store(p_opt::parse_command_line(argc, argv, description), var_map);
+
+        if (var_map.count("help")) {
+            std::cout << description << "\n";
+            return 0;
+        }
+
+        p_opt::notify(var_map);
+    }
+    catch (std::exception &e) {
+        std::cout << e.what() << '\n';
+        return 1;
+    }
+    players_count = (uint8_t)players_count_to_load;
+    if (policy != "idle" && policy != "random" && policy != "bot") {
+        std::cout << "Unknown policy\n";
+        return 1;
+    }
+    if (parameters.size_x == 0 || parameters.size_y == 0) {
+        std::cout << "Empty board\n";
+        return 1;
+    }
+
+    std::vector<game_stats> games(games_count);
+    work_stealing_pool pool(std::max(threads_count, (uint16_t) 1));
+    auto start = std::chrono::steady_clock::now();
+    pool.run(games_count, [&](size_t game) {
+        games[game] = simulate_game((uint32_t) (first_seed + game));
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (uint32_t game = 0; game < games_count; game++) {
+        auto &stats = games[game];
+        std::cout << "seed: " << first_seed + game << ", turns: " << stats.turns << ", bombs: " << stats.bombs
+                  << ", explosions: " << stats.explosions << ", blocks destroyed: " << stats.blocks_destroyed
+                  << ", blocks left: " << stats.blocks_left << ", scores:";
+        for (auto score : stats.scores) {
+            std::cout << " " << score;
+        }
+        std::cout << "\n";
+    }
+    std::cerr << "games: " << games_count << ", time: " << elapsed.count() << " s, "
+              << (uint64_t) (games_count / elapsed.count()) << " games/s" << std::endl;
+    return 0;
+}
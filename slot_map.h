@@ -0,0 +1,89 @@
+#ifndef SIK_2022_SLOT_MAP_H
+#define SIK_2022_SLOT_MAP_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/* = = = = = = = *
+ * SLOT MAP      *
+ * = = = = = = = */
+
+/* Wartości są trzymane w ciągłym wektorze (szybkie przeglądanie wszystkich, np. przy rozsyłaniu),
+ * a identyfikator wskazuje slot, który zna aktualną pozycję wartości w wektorze.
+ * Usuwanie przenosi ostatnią wartość w miejsce usuniętej, więc wstawianie i usuwanie są O(1).
+ * Slot po zwolnieniu dostaje nową generację, więc stary identyfikator nie wskaże nowej wartości. */
+struct slot_id {
+    uint32_t index;
+    uint32_t generation;
+};
+
+template<typename T>
+class slot_map {
+public:
+    slot_id insert(T value) {
+        uint32_t index;
+        if (free_head_ != NO_SLOT) {
+            index = free_head_;
+            free_head_ = slots_[index].position;
+        } else {
+            index = (uint32_t) slots_.size();
+            slots_.push_back({0, 0});
+        }
+        slots_[index].position = (uint32_t) values_.size();
+        values_.push_back(std::move(value));
+        values_slots_.push_back(index);
+        return {index, slots_[index].generation};
+    }
+
+    // Returns false if value with given id was already removed
+    bool erase(slot_id id) {
+        if (!contains(id))
+            return false;
+        auto &slot = slots_[id.index];
+        auto position = slot.position;
+        if (position + 1 != values_.size()) { // last value takes place of the removed one
+            values_[position] = std::move(values_.back());
+            values_slots_[position] = values_slots_.back();
+            slots_[values_slots_[position]].position = position;
+        }
+        values_.pop_back();
+        values_slots_.pop_back();
+        slot.generation++;
+        slot.position = free_head_;
+        free_head_ = id.index;
+        return true;
+    }
+
+    bool contains(slot_id id) const {
+        return id.index < slots_.size() && slots_[id.index].generation == id.generation;
+    }
+
+    size_t size() const {
+        return values_.size();
+    }
+
+    // Iteration order changes after erase
+    auto begin() {
+        return values_.begin();
+    }
+
+    auto end() {
+        return values_.end();
+    }
+
+private:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    struct slot {
+        uint32_t generation;
+        uint32_t position; // in values_ if slot is used, next free slot otherwise
+    };
+
+    std::vector<T> values_;
+    std::vector<uint32_t> values_slots_; // slot index of each value
+    std::vector<slot> slots_;
+    uint32_t free_head_ = NO_SLOT;
+};
+
+#endif //SIK_2022_SLOT_MAP_H
@@ -0,0 +1,61 @@
+#ifndef SIK_2022_SPSC_QUEUE_H
+#define SIK_2022_SPSC_QUEUE_H
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+/* = = = = = = = = = = = = = = = = = = = = = = *
+ * LOCK-FREE SINGLE PRODUCER SINGLE CONSUMER   *
+ * = = = = = = = = = = = = = = = = = = = = = = */
+
+/* Nieograniczona kolejka jednokierunkowa: lista z węzłem-strażnikiem, producent dopisuje na końcu,
+ * konsument zdejmuje z początku. Każdy z nich zmienia tylko swój koniec, więc wystarczy
+ * jeden atomowy wskaźnik next w każdym węźle. Producent nigdy nie czeka na konsumenta. */
+template<typename T>
+class spsc_queue {
+public:
+    spsc_queue() : head_(new node), tail_(head_) {}
+
+    ~spsc_queue() {
+        while (head_) {
+            auto next = head_->next.load(std::memory_order_relaxed);
+            delete head_;
+            head_ = next;
+        }
+    }
+
+    spsc_queue(const spsc_queue &) = delete;
+    spsc_queue &operator=(const spsc_queue &) = delete;
+
+    // Only the producer thread can run this function
+    void push(T value) {
+        auto new_node = new node;
+        new_node->value.emplace(std::move(value));
+        tail_->next.store(new_node, std::memory_order_release);
+        tail_ = new_node;
+    }
+
+    // Only the consumer thread can run this function, returns false if queue is empty
+    bool pop(T *value) {
+        auto next = head_->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return false;
+        *value = std::move(next->value.value());
+        next->value.reset(); // next becomes the new sentinel
+        delete head_;
+        head_ = next;
+        return true;
+    }
+
+private:
+    struct node {
+        std::optional<T> value;
+        std::atomic<node *> next = nullptr;
+    };
+
+    alignas(64) node *head_; // sentinel, used by consumer
+    alignas(64) node *tail_; // used by producer
+};
+
+#endif //SIK_2022_SPSC_QUEUE_H
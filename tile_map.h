@@ -0,0 +1,161 @@
+#ifndef SIK_2022_TILE_MAP_H
+#define SIK_2022_TILE_MAP_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+#define TILE_SIZE_BITS 6
+#define TILE_SIZE (1 << TILE_SIZE_BITS) // cells along one side of a tile
+
+/* = = = = = = = = = = = = = *
+ * SPARSE BOARD OF TILES     *
+ * = = = = = = = = = = = = = */
+
+/* Zbiór pól planszy podzielonej na kafelki 64x64 pola. Kafelek (bitmapa 512 bajtów) jest
+ * alokowany dopiero gdy pojawi się na nim pierwsze pole i zwalniany, gdy zniknie ostatnie,
+ * więc pamięć zależy od liczby zajętych kafelków, a nie od rozmiaru planszy (do 65535x65535).
+ * Współrzędne zawijają się modulo 65536 tak samo jak Position. */
+class tile_map {
+public:
+    bool contains(Position position) const {
+        auto tile = find_tile(position);
+        return tile != nullptr && tile->contains(position);
+    }
+
+    // Returns false if position was already in the map
+    bool insert(Position position) {
+        auto &tile = tiles_[tile_key(position)];
+        if (!tile)
+            tile = std::make_unique<tile_t>();
+        if (tile->contains(position))
+            return false;
+        tile->set(position, true);
+        size_++;
+        return true;
+    }
+
+    // Returns false if position wasn't in the map
+    bool erase(Position position) {
+        auto found = tiles_.find(tile_key(position));
+        if (found == tiles_.end() || !found->second->contains(position))
+            return false;
+        found->second->set(position, false);
+        size_--;
+        if (found->second->count == 0)
+            tiles_.erase(found);
+        return true;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    void clear() {
+        tiles_.clear();
+        size_ = 0;
+    }
+
+    // Looks for the first position in the map on the ray from + i * (dx, dy) for i in [from_distance, max_distance].
+    // Returns its distance or max_distance + 1 if there is none. Tiles that are not allocated are skipped at once.
+    uint32_t first_on_ray(Position from, int dx, int dy, uint32_t from_distance, uint32_t max_distance) const {
+        if (dx == 0 && dy == 0)
+            return contains(from) ? from_distance : max_distance + 1;
+        uint32_t distance = from_distance;
+        while (distance <= max_distance) {
+            Position position = {(uint16_t) (from.first + dx * (int) distance),
+                                 (uint16_t) (from.second + dy * (int) distance)};
+            auto cells_left = cells_to_tile_border(position, dx, dy);
+            auto tile = find_tile(position);
+            if (tile != nullptr) {
+                for (uint32_t i = 0; i < cells_left && distance <= max_distance; i++, distance++) {
+                    if (tile->contains(position))
+                        return distance;
+                    position.first = (uint16_t) (position.first + dx);
+                    position.second = (uint16_t) (position.second + dy);
+                }
+            } else {
+                distance += cells_left;
+            }
+        }
+        return max_distance + 1;
+    }
+
+    // Positions ordered by tile and then by position in tile
+    std::vector<Position> positions() const {
+        std::vector<std::pair<uint32_t, const tile_t *>> tiles;
+        tiles.reserve(tiles_.size());
+        for (auto &tile : tiles_) {
+            tiles.push_back({tile.first, tile.second.get()});
+        }
+        std::sort(tiles.begin(), tiles.end());
+        std::vector<Position> result;
+        result.reserve(size_);
+        for (auto &tile : tiles) {
+            auto tile_x = (uint16_t) ((tile.first >> 16) << TILE_SIZE_BITS);
+            auto tile_y = (uint16_t) ((tile.first & 0xffff) << TILE_SIZE_BITS);
+            for (size_t row = 0; row < TILE_SIZE; row++) {
+                auto bits = tile.second->rows[row];
+                while (bits != 0) {
+                    auto column = std::countr_zero(bits);
+                    bits &= bits - 1;
+                    result.push_back({(uint16_t) (tile_x + column), (uint16_t) (tile_y + row)});
+                }
+            }
+        }
+        return result;
+    }
+
+private:
+    struct tile_t {
+        std::array<uint64_t, TILE_SIZE> rows{}; // bit x of rows[y] is cell (x, y) of the tile
+        uint16_t count = 0;
+
+        bool contains(Position position) const {
+            return (rows[position.second % TILE_SIZE] >> (position.first % TILE_SIZE)) & 1;
+        }
+
+        void set(Position position, bool value) {
+            auto bit = (uint64_t) 1 << (position.first % TILE_SIZE);
+            if (value) {
+                rows[position.second % TILE_SIZE] |= bit;
+                count++;
+            } else {
+                rows[position.second % TILE_SIZE] &= ~bit;
+                count--;
+            }
+        }
+    };
+
+    static uint32_t tile_key(Position position) {
+        return ((uint32_t) (position.first >> TILE_SIZE_BITS) << 16) | (uint32_t) (position.second >> TILE_SIZE_BITS);
+    }
+
+    // Number of cells the ray goes through before leaving the tile of position (including position)
+    static uint32_t cells_to_tile_border(Position position, int dx, int dy) {
+        if (dx > 0)
+            return TILE_SIZE - position.first % TILE_SIZE;
+        if (dx < 0)
+            return position.first % TILE_SIZE + 1;
+        if (dy > 0)
+            return TILE_SIZE - position.second % TILE_SIZE;
+        if (dy < 0)
+            return position.second % TILE_SIZE + 1;
+        return 1; // ray doesn't move
+    }
+
+    const tile_t *find_tile(Position position) const {
+        auto found = tiles_.find(tile_key(position));
+        return found == tiles_.end() ? nullptr : found->second.get();
+    }
+
+    std::unordered_map<uint32_t, std::unique_ptr<tile_t>> tiles_;
+    size_t size_ = 0;
+};
+
+#endif //SIK_2022_TILE_MAP_H
@@ -0,0 +1,220 @@
+#ifndef SIK_2022_TRACER_H
+#define SIK_2022_TRACER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#define TRACE_RING_SIZE 65536 // spans of one thread waiting for the writer, next ones are dropped
+#define TRACE_WRITE_INTERVAL_MS 100
+
+/* = = = = = = = = = = = = = = = = = = *
+ * TRACE OF TURN PHASES AND HANDLERS   *
+ * = = = = = = = = = = = = = = = = = = */
+
+/* Opcjonalny zapis odcinków czasu (span) w formacie Chrome trace event (JSON), do obejrzenia
+ * w chrome://tracing albo w Perfetto. Każdy wątek zapisuje swoje odcinki do własnego bufora
+ * cyklicznego bez blokad (jeden producent - ten wątek, jeden konsument - wątek zapisujący),
+ * a wątek zapisujący co TRACE_WRITE_INTERVAL_MS przepisuje je do pliku. Plik da się wczytać
+ * także gdy program został zabity, bo format dopuszcza brak zamykającego nawiasu.
+ * Przy wyłączonym śledzeniu odcinek kosztuje tylko odczyt jednej flagi. */
+
+inline std::atomic<bool> tracing_enabled = false;
+inline const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+struct trace_event {
+    const char *name; // string literal
+    int64_t start; // in nanoseconds since trace_epoch
+    int64_t duration; // in nanoseconds
+};
+
+class trace_ring {
+public:
+    explicit trace_ring(uint32_t thread_id) : thread_id(thread_id) {}
+
+    const uint32_t thread_id; // tid in the trace
+    std::atomic<const char *> thread_name = nullptr;
+
+    // Only the thread owning the ring can run this function
+    void push(const trace_event &event) {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        events_[head % TRACE_RING_SIZE] = event;
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // Only the writer thread can run this function
+    template<typename Function>
+    void drain(Function function) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            function(events_[tail % TRACE_RING_SIZE]);
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+    uint64_t take_dropped() {
+        return dropped_.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<trace_event, TRACE_RING_SIZE> events_;
+    alignas(64) std::atomic<uint64_t> head_ = 0; // written by the owning thread
+    alignas(64) std::atomic<uint64_t> tail_ = 0; // written by the writer thread
+    std::atomic<uint64_t> dropped_ = 0;
+};
+
+// Rings of all threads that recorded anything, a thread takes the lock only when it records its first span
+class trace_registry {
+public:
+    trace_ring &thread_ring() {
+        thread_local std::shared_ptr<trace_ring> ring; // kept alive by the thread even after the registry is gone
+        if (!ring) {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            ring = std::make_shared<trace_ring>(next_thread_id_++);
+            rings_.push_back(ring);
+        }
+        return *ring;
+    }
+
+    template<typename Function>
+    void for_each(Function function) {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &ring : rings_) {
+            function(*ring);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<trace_ring>> rings_;
+    uint32_t next_thread_id_ = 1;
+};
+
+inline trace_registry trace_rings;
+
+// Records time from construction to destruction if tracing was enabled at construction
+class trace_span {
+public:
+    explicit trace_span(const char *name) : name_(name) {
+        if (tracing_enabled.load(std::memory_order_relaxed))
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~trace_span() {
+        if (!start_)
+            return;
+        auto end = std::chrono::steady_clock::now();
+        trace_rings.thread_ring().push({
+                name_,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(start_.value() - trace_epoch).count(),
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_.value()).count()
+        });
+    }
+
+    trace_span(const trace_span &) = delete;
+    trace_span &operator=(const trace_span &) = delete;
+
+private:
+    const char *name_;
+    std::optional<std::chrono::steady_clock::time_point> start_; // empty if tracing is disabled
+};
+
+// Name of the calling thread shown in the trace, name has to be a string literal
+inline void trace_thread_name(const char *name) {
+    if (tracing_enabled.load(std::memory_order_relaxed))
+        trace_rings.thread_ring().thread_name = name;
+}
+
+// While it exists, spans are recorded and written to the file
+class trace_writer {
+public:
+    trace_writer(const std::string &file_name, const char *process_name)
+            : file_(file_name), process_name_(process_name), pid_(getpid()) {
+        if (!file_)
+            return;
+        file_ << "[\n" << std::fixed << std::setprecision(3);
+        tracing_enabled = true;
+        thread_ = std::thread(&trace_writer::write_loop, this);
+    }
+
+    ~trace_writer() {
+        if (!thread_.joinable())
+            return;
+        tracing_enabled = false;
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        stopped_.notify_one();
+        thread_.join();
+        write_events(); // spans that ended before tracing was disabled
+        file_ << R"({"name":"process_name","ph":"M","pid":)" << pid_
+              << R"(,"args":{"name":")" << process_name_ << "\"}}\n]\n";
+    }
+
+    trace_writer(const trace_writer &) = delete;
+    trace_writer &operator=(const trace_writer &) = delete;
+
+    bool is_open() const {
+        return file_.good();
+    }
+
+private:
+    void write_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopped_.wait_for(lock, std::chrono::milliseconds(TRACE_WRITE_INTERVAL_MS),
+                                  [this]{ return stopping_; })) {
+            write_events();
+        }
+    }
+
+    // Called only by one thread at a time
+    void write_events() {
+        trace_rings.for_each([this](trace_ring &ring) {
+            auto thread_name = ring.thread_name.load();
+            if (thread_name != nullptr && named_threads_.size() <= ring.thread_id)
+                named_threads_.resize(ring.thread_id + 1, false);
+            if (thread_name != nullptr && !named_threads_[ring.thread_id]) {
+                named_threads_[ring.thread_id] = true;
+                file_ << R"({"name":"thread_name","ph":"M","pid":)" << pid_ << R"(,"tid":)" << ring.thread_id
+                      << R"(,"args":{"name":")" << thread_name << "\"}},\n";
+            }
+            ring.drain([this, &ring](const trace_event &event) {
+                file_ << R"({"name":")" << event.name << R"(","ph":"X","ts":)" << (double) event.start / 1000
+                      << R"(,"dur":)" << (double) event.duration / 1000 << R"(,"pid":)" << pid_
+                      << R"(,"tid":)" << ring.thread_id << "},\n";
+            });
+            auto dropped = ring.take_dropped();
+            if (dropped > 0)
+                std::cerr << "Warning: trace buffer full, " << dropped << " spans dropped" << std::endl;
+        });
+        file_.flush();
+    }
+
+    std::ofstream file_;
+    const char *process_name_;
+    pid_t pid_;
+    std::vector<bool> named_threads_; // by thread id, name already written
+    std::mutex mutex_; // guards stopping_
+    std::condition_variable stopped_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+#endif //SIK_2022_TRACER_H
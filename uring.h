@@ -0,0 +1,385 @@
+#ifndef SIK_2022_URING_H
+#define SIK_2022_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "common.h"
+
+#define URING_ENTRIES 4096
+#define URING_SLOT_COUNT 64
+#define URING_SLOT_SIZE 65536
+
+/* Wysyłanie przez io_uring zamiast reaktora epoll z boost::asio.
+ * Zapisy zgłoszone w jednej turze io_context trafiają do jądra jednym wywołaniem io_uring_enter.
+ * Komunikaty rozsyłane do wszystkich klientów są kopiowane raz do zarejestrowanego bufora
+ * i wysyłane z niego do każdego połączenia przez IORING_OP_WRITE_FIXED.
+ * Nie korzysta z liburing, pierścienie są obsługiwane bezpośrednio przez wywołania systemowe. */
+class uring_transport {
+public:
+    typedef std::function<void(const boost::system::error_code &)> write_handler;
+
+    // Returns nullptr if io_uring is not available
+    static std::unique_ptr<uring_transport> create(boost::asio::io_context &io_context) {
+        std::unique_ptr<uring_transport> transport(new uring_transport(io_context));
+        if (!transport->setup())
+            return nullptr;
+        transport->register_slots();
+        transport->completion_thread_ = std::thread(&uring_transport::reap_completions, transport.get());
+        return transport;
+    }
+
+    ~uring_transport() {
+        if (completion_thread_.joinable()) {
+            {
+                const std::lock_guard<std::mutex> lock(mutex_);
+                prepare(nullptr); // NOP that wakes up and stops the completion thread
+                submit();
+            }
+            completion_thread_.join();
+        }
+        if (sqes_ != nullptr)
+            munmap(sqes_, sqes_size_);
+        if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+            munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_ != nullptr)
+            munmap(sq_ring_, sq_ring_size_);
+        if (ring_fd_ >= 0)
+            close(ring_fd_);
+    }
+
+    // Copies buffer to a registered slot, returns buffer unchanged if it doesn't fit or there is no free slot
+    std::shared_ptr<const message_buffer> registered_copy(const std::shared_ptr<const message_buffer> &buffer) {
+        if (!slots_registered_ || buffer->size() > URING_SLOT_SIZE)
+            return buffer;
+        int slot;
+        {
+            const std::lock_guard<std::mutex> lock(slots_mutex_);
+            if (free_slots_.empty())
+                return buffer;
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        }
+        buffer->copy_to(slots_[slot]->data());
+        message_buffer::block block(slots_[slot].get(), [this, slot](const std::string *) {
+            const std::lock_guard<std::mutex> lock(slots_mutex_);
+            free_slots_.push_back(slot);
+        });
+        auto result = std::make_shared<message_buffer>();
+        result->append_block(block, buffer->size());
+        return result;
+    }
+
+    // Writes all buffers to fd, handler is called from the completion thread.
+    // Submission is delayed until the end of current io_context turn, so that writes are batched.
+    // Empty buffers are skipped, a write of nothing succeeds without going to the kernel.
+    void async_write(int fd, std::vector<iovec> buffers, write_handler handler) {
+        std::erase_if(buffers, [](const iovec &buffer) { return buffer.iov_len == 0; });
+        const std::lock_guard<std::mutex> lock(mutex_);
+        if (buffers.empty() || failed_) { // nothing to write, or the completion thread is gone
+            auto error = buffers.empty() ? 0 : EIO;
+            boost::asio::post(io_context_, [handler = std::move(handler), error]() {
+                handler(boost::system::error_code(error, boost::system::system_category()));
+            });
+            return;
+        }
+        auto op = new write_op{fd, std::move(buffers), -1, false, std::move(handler)};
+        if (op->remaining.size() == 1)
+            op->buffer_index = find_slot(op->remaining[0].iov_base);
+        in_flight_.insert(op);
+        prepare(op);
+        if (!submit_scheduled_) {
+            submit_scheduled_ = true;
+            boost::asio::post(io_context_, [this]() {
+                const std::lock_guard<std::mutex> lock(mutex_);
+                submit_scheduled_ = false;
+                submit();
+            });
+        }
+    }
+
+private:
+    struct write_op {
+        int fd;
+        std::vector<iovec> remaining;
+        int buffer_index; // registered slot for IORING_OP_WRITE_FIXED, -1 for IORING_OP_WRITEV
+        bool waiting_for_poll; // socket buffer was full, waiting until it is writable again
+        write_handler handler;
+    };
+
+    explicit uring_transport(boost::asio::io_context &io_context) : io_context_(io_context) {}
+
+    bool setup() {
+        io_uring_params params{};
+        ring_fd_ = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+        if (ring_fd_ < 0)
+            return false;
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+        sq_ring_ = map_ring(sq_ring_size_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == nullptr)
+            return false;
+        cq_ring_ = single_mmap ? sq_ring_ : map_ring(cq_ring_size_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == nullptr)
+            return false;
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = (io_uring_sqe *) map_ring(sqes_size_, IORING_OFF_SQES);
+        if (sqes_ == nullptr)
+            return false;
+
+        sq_head_ = (unsigned *) (sq_ring_ + params.sq_off.head);
+        sq_tail_ = (unsigned *) (sq_ring_ + params.sq_off.tail);
+        sq_mask_ = *(unsigned *) (sq_ring_ + params.sq_off.ring_mask);
+        sq_array_ = (unsigned *) (sq_ring_ + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+        cq_head_ = (unsigned *) (cq_ring_ + params.cq_off.head);
+        cq_tail_ = (unsigned *) (cq_ring_ + params.cq_off.tail);
+        cq_mask_ = *(unsigned *) (cq_ring_ + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe *) (cq_ring_ + params.cq_off.cqes);
+        return true;
+    }
+
+    char *map_ring(size_t size, off_t offset) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+        return ptr == MAP_FAILED ? nullptr : (char *) ptr;
+    }
+
+    // Without registered slots every write goes through IORING_OP_WRITEV
+    void register_slots() {
+        std::vector<iovec> iovecs;
+        for (int i = 0; i < URING_SLOT_COUNT; i++) {
+            slots_.push_back(std::make_shared<std::string>(URING_SLOT_SIZE, '\0'));
+            iovecs.push_back({slots_.back()->data(), URING_SLOT_SIZE});
+            free_slots_.push_back(i);
+        }
+        slots_registered_ = syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                                    iovecs.data(), (unsigned) iovecs.size()) == 0;
+        if (!slots_registered_)
+            std::cerr << "Warning: registering io_uring buffers failed, using writev" << std::endl;
+    }
+
+    int find_slot(const void *ptr) {
+        if (!slots_registered_)
+            return -1;
+        for (size_t i = 0; i < slots_.size(); i++) {
+            if (slots_[i]->data() == ptr)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    // You need to have mutex_ to run this function
+    bool queue_full() const {
+        return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_;
+    }
+
+    // Queues op, nullptr is a NOP stopping the completion thread. You need to have mutex_ to run this function
+    void prepare(write_op *op) {
+        backlog_.push_back(op);
+        fill_queue();
+        if (!backlog_.empty())
+            submit(); // submission queue full, hand it over to the kernel now
+    }
+
+    // Moves ops waiting in the backlog to free entries of the submission queue, an entry is never
+    // written before the kernel has taken it. You need to have mutex_ to run this function
+    void fill_queue() {
+        while (!backlog_.empty() && !queue_full()) {
+            write_sqe(backlog_.front());
+            backlog_.pop_front();
+        }
+    }
+
+    // You need to have mutex_ to run this function
+    void write_sqe(write_op *op) {
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & sq_mask_;
+        sq_array_[index] = index;
+        io_uring_sqe *sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        if (op == nullptr) {
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = 0;
+        } else {
+            fill_write_sqe(sqe, op);
+        }
+        // Release orders the writes to op and its entry before the completion thread reads them
+        written_sqes_.fetch_add(1, std::memory_order_release);
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        to_submit_++;
+    }
+
+    void fill_write_sqe(io_uring_sqe *sqe, write_op *op) {
+        sqe->fd = op->fd;
+        if (op->waiting_for_poll) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll32_events = POLLOUT;
+        } else if (op->buffer_index >= 0) {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->addr = (uint64_t) op->remaining[0].iov_base;
+            sqe->len = (uint32_t) op->remaining[0].iov_len;
+            sqe->buf_index = (uint16_t) op->buffer_index;
+        } else {
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->addr = (uint64_t) op->remaining.data();
+            sqe->len = (uint32_t) op->remaining.size();
+        }
+        sqe->user_data = (uint64_t) op;
+    }
+
+    // Hands queued entries and then the backlog over to the kernel. Returns false if the kernel didn't take
+    // them, they are submitted again with the next submit. You need to have mutex_ to run this function
+    bool submit() {
+        while (true) {
+            while (to_submit_ > 0) {
+                auto submitted = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 0, 0, nullptr, 0);
+                if (submitted < 0 && errno == EINTR)
+                    continue;
+                if (submitted <= 0) {
+                    std::cerr << "Error: io_uring_enter failed" << std::endl;
+                    return false;
+                }
+                to_submit_ -= (unsigned) submitted;
+            }
+            if (backlog_.empty())
+                return true;
+            fill_queue();
+        }
+    }
+
+    void reap_completions() {
+        while (true) {
+            auto result = syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result < 0 && errno != EINTR) {
+                std::cerr << "Error: waiting for io_uring completions failed" << std::endl;
+                fail_in_flight();
+                return;
+            }
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            // Pairs with write_sqe, the kernel orders it too, but ThreadSanitizer doesn't see that
+            written_sqes_.load(std::memory_order_acquire);
+            while (head != tail) {
+                io_uring_cqe cqe = cqes_[head & cq_mask_];
+                head++;
+                __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+                if (cqe.user_data == 0)
+                    return;
+                complete((write_op *) cqe.user_data, cqe.res);
+            }
+            const std::lock_guard<std::mutex> lock(mutex_);
+            if (to_submit_ > 0 || !backlog_.empty()) // the last submit failed, completions may have made room
+                submit();
+        }
+    }
+
+    /* Nikt już nie odbierze zakończeń, więc wszystkie rozpoczęte zapisy kończą się błędem - inaczej
+     * połączenia czekałyby na nie w nieskończoność. Operacje nie są zwalniane, bo jądro może jeszcze
+     * używać ich tablic iovec, a kolejne zapisy od razu dostają błąd. */
+    void fail_in_flight() {
+        std::vector<write_op *> ops;
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            failed_ = true;
+            ops.assign(in_flight_.begin(), in_flight_.end());
+            in_flight_.clear();
+            backlog_.clear();
+        }
+        for (auto op : ops) {
+            op->handler(boost::system::error_code(EIO, boost::system::system_category()));
+        }
+    }
+
+    void complete(write_op *op, int result) {
+        if (op->waiting_for_poll) {
+            op->waiting_for_poll = false;
+            if (result < 0)
+                return finish(op, -result);
+        } else if (result == -EAGAIN) {
+            op->waiting_for_poll = true;
+        } else if (result < 0) {
+            return finish(op, -result);
+        } else if (result == 0) {
+            return finish(op, EPIPE);
+        } else {
+            auto written = (size_t) result;
+            auto it = op->remaining.begin();
+            while (it != op->remaining.end() && written >= it->iov_len) {
+                written -= it->iov_len;
+                it++;
+            }
+            op->remaining.erase(op->remaining.begin(), it);
+            if (op->remaining.empty())
+                return finish(op, 0);
+            op->remaining[0].iov_base = (char *) op->remaining[0].iov_base + written;
+            op->remaining[0].iov_len -= written;
+        }
+        // resubmit the rest of partial write, or write again after poll
+        const std::lock_guard<std::mutex> lock(mutex_);
+        prepare(op);
+        submit();
+    }
+
+    void finish(write_op *op, int error) {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_.erase(op);
+        }
+        op->handler(boost::system::error_code(error, boost::system::system_category()));
+        delete op;
+    }
+
+    boost::asio::io_context &io_context_;
+    std::thread completion_thread_;
+
+    int ring_fd_ = -1;
+    char *sq_ring_ = nullptr;
+    char *cq_ring_ = nullptr;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    size_t sqes_size_ = 0;
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+
+    std::mutex mutex_; // guards submission queue, backlog_, in_flight_ and failed_
+    unsigned to_submit_ = 0;
+    std::atomic<uint64_t> written_sqes_ = 0; // only publishes ops to the completion thread
+    bool submit_scheduled_ = false;
+    std::deque<write_op *> backlog_; // waiting for a free entry of the submission queue
+    std::unordered_set<write_op *> in_flight_; // started and not finished yet
+    bool failed_ = false; // completion thread stopped on error
+
+    std::mutex slots_mutex_;
+    std::vector<std::shared_ptr<std::string>> slots_;
+    std::vector<int> free_slots_;
+    bool slots_registered_ = false;
+};
+
+#endif //SIK_2022_URING_H
@@ -0,0 +1,146 @@
+#ifndef SIK_2022_WORK_STEALING_POOL_H
+#define SIK_2022_WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* = = = = = = = = = = = = = = *
+ * WORK STEALING THREAD POOL   *
+ * = = = = = = = = = = = = = = */
+
+/* Pula wątków wykonująca paczki niezależnych zadań (indeksy 0..n-1).
+ * Każdy wątek dostaje ciągły fragment indeksów, bierze zadania z początku swojej kolejki,
+ * a gdy ona się skończy podbiera zadania z końca kolejek innych wątków.
+ * Wątek wywołujący run() też wykonuje zadania (jako wątek 0). */
+class work_stealing_pool {
+public:
+    explicit work_stealing_pool(size_t threads_count) : queues_(threads_count) {
+        for (size_t i = 1; i < threads_count; i++) {
+            workers_.emplace_back(&work_stealing_pool::worker_loop, this, i);
+        }
+    }
+
+    ~work_stealing_pool() {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    work_stealing_pool(const work_stealing_pool &) = delete;
+    work_stealing_pool &operator=(const work_stealing_pool &) = delete;
+
+    size_t threads_count() const {
+        return queues_.size();
+    }
+
+    // Runs task(0), ..., task(tasks_count - 1), returns after all of them finished.
+    // Only one run() can be in progress at a time.
+    void run(size_t tasks_count, const std::function<void(size_t)> &task) {
+        if (tasks_count == 0)
+            return;
+        auto chunk = (tasks_count + queues_.size() - 1) / queues_.size();
+        for (size_t i = 0; i < queues_.size(); i++) {
+            const std::lock_guard<std::mutex> lock(queues_[i].mutex);
+            for (size_t task_index = i * chunk; task_index < std::min(tasks_count, (i + 1) * chunk); task_index++) {
+                queues_[i].tasks.push_back(task_index);
+            }
+        }
+        remaining_ = tasks_count;
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            generation_++;
+        }
+        work_available_.notify_all();
+
+        work(0, task);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Workers still holding pointer to task have to finish before it goes out of scope
+        all_done_.wait(lock, [this]{ return remaining_ == 0 && active_workers_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    // Own tasks are taken from the front, stolen ones from the back
+    bool take_task(size_t worker, size_t *task_index) {
+        for (size_t i = 0; i < queues_.size(); i++) {
+            auto &queue = queues_[(worker + i) % queues_.size()];
+            const std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (i == 0) {
+                *task_index = queue.tasks.front();
+                queue.tasks.pop_front();
+            } else {
+                *task_index = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t worker, const std::function<void(size_t)> &task) {
+        size_t task_index;
+        while (take_task(worker, &task_index)) {
+            task(task_index);
+            if (remaining_.fetch_sub(1) == 1) {
+                { const std::lock_guard<std::mutex> lock(mutex_); } // caller can't miss the notification
+                all_done_.notify_all();
+            }
+        }
+    }
+
+    void worker_loop(size_t worker) {
+        uint64_t seen_generation = 0;
+        while (true) {
+            const std::function<void(size_t)> *task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_available_.wait(lock, [&]{ return stopping_ || generation_ != seen_generation; });
+                if (stopping_)
+                    return;
+                seen_generation = generation_;
+                if (!task_)
+                    continue; // woken up after the run has already finished
+                task = task_;
+                active_workers_++;
+            }
+            work(worker, *task);
+            {
+                const std::lock_guard<std::mutex> lock(mutex_);
+                active_workers_--;
+            }
+            all_done_.notify_all();
+        }
+    }
+
+    std::vector<task_queue> queues_; // one for each thread
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> remaining_ = 0;
+    std::mutex mutex_; // guards fields below
+    std::condition_variable work_available_;
+    std::condition_variable all_done_;
+    const std::function<void(size_t)> *task_ = nullptr;
+    uint64_t generation_ = 0;
+    size_t active_workers_ = 0;
+    bool stopping_ = false;
+};
+
+#endif //SIK_2022_WORK_STEALING_POOL_H